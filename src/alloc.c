@@ -0,0 +1,66 @@
+#ifdef __linux__
+#	define _GNU_SOURCE /* madvise, syscall */
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "alloc.h"
+
+/* transparent huge page size on common hardware */
+#define HUGE_PAGE_SZ (2 << 20)
+
+/* from linux/mempolicy.h, which isn't always installed */
+#define MPOL_INTERLEAVE 3
+#define MPOL_F_MEMS_ALLOWED (1 << 2)
+#define NODE_MAX 1024
+
+/* allocates a large block of memory, asking for it to be backed by
+ * transparent huge pages and (optionally) interleaved across every
+ * NUMA node the process may use; the memory is not zeroed or even
+ * touched, so each page lands on the node of the thread that first
+ * writes to it; release it with free()
+ */
+void *alloc_huge(size_t sz, bool isInterleaved)
+{
+#ifdef __linux__
+	void *mem;
+	size_t len = sz & ~((size_t)HUGE_PAGE_SZ - 1);
+	
+	if (sz < HUGE_PAGE_SZ)
+		return malloc(sz);
+	
+	if (posix_memalign(&mem, HUGE_PAGE_SZ, sz))
+		return 0;
+	
+	if (madvise(mem, len, MADV_HUGEPAGE))
+		fprintf(stderr, "warning: transparent huge pages are not available\n");
+	
+#ifdef SYS_mbind
+	if (isInterleaved)
+	{
+		unsigned long mask[NODE_MAX / (8 * sizeof(unsigned long))] = {0};
+		int mode;
+		
+		if (syscall(SYS_get_mempolicy, &mode, mask, NODE_MAX, (void*)0, MPOL_F_MEMS_ALLOWED)
+			|| syscall(SYS_mbind, mem, len, MPOL_INTERLEAVE, mask, NODE_MAX, 0)
+		)
+			fprintf(stderr, "warning: NUMA interleaving is not available\n");
+	}
+#else
+	if (isInterleaved)
+		fprintf(stderr, "warning: NUMA interleaving is not available\n");
+#endif
+	
+	return mem;
+#else
+	if (isInterleaved)
+		fprintf(stderr, "warning: NUMA interleaving is not available\n");
+	
+	return malloc(sz);
+#endif
+}
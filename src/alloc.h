@@ -0,0 +1,9 @@
+#ifndef ALLOC_H_INCLUDED
+#define ALLOC_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+void *alloc_huge(size_t sz, bool isInterleaved);
+
+#endif /* ALLOC_H_INCLUDED */
@@ -0,0 +1,641 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "bench.h"
+#include "inv.h"
+#include "common.h"
+#include "mask.h"
+#include "render.h"
+
+static int max2(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+/* inv_get_planes callback that only counts the planes */
+static int count_plane(void *udata, const void *pixels, int image, int w, int h)
+{
+	(void)pixels;
+	(void)image;
+	(void)w;
+	(void)h;
+	
+	*(int*)udata += 1;
+	
+	return 0;
+}
+
+/* time a sweep through every slice of each plane, one at a time and batched */
+static void bench_reslice(struct inv *inv)
+{
+	const char *plane_name[] = { "axial", "sagittal", "coronal" };
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	int d = inv_get_num_images(inv);
+	int arr[] = { d, w, h }; // num images per plane
+	int big = max2(max2(w, h), d);
+	uint16_t *pix = malloc((size_t)big * big * sizeof(*pix));
+	int i;
+	
+	if (!pix)
+	{
+		fprintf(stderr, "memory error\n");
+		return;
+	}
+	
+	fprintf(stdout, "reslice %dx%dx%d:\n", w, h, d);
+	for (i = 0; i < INV_PLANE_NUM; ++i)
+	{
+		double start = timer_now();
+		double elapsed;
+		int k;
+		
+		for (k = 0; k < arr[i]; ++k)
+			inv_get_plane(inv, pix, k, i);
+		
+		elapsed = timer_now() - start;
+		fprintf(stdout, "  %-8s %4d slices %9.3f ms total %8.3f ms/slice\n"
+			, plane_name[i], arr[i], elapsed * 1e3, elapsed * 1e3 / arr[i]
+		);
+	}
+	for (i = 0; i < INV_PLANE_NUM; ++i)
+	{
+		double start = timer_now();
+		double elapsed;
+		int n = 0;
+		
+		inv_get_planes(inv, 0, arr[i], i, count_plane, &n);
+		
+		elapsed = timer_now() - start;
+		fprintf(stdout, "  %-8s %4d slices %9.3f ms total %8.3f ms/slice (batched)\n"
+			, plane_name[i], n, elapsed * 1e3, elapsed * 1e3 / max2(n, 1)
+		);
+	}
+	
+	free(pix);
+}
+
+/* time a sweep through every slice of each plane at thumbnail size */
+static void bench_reslice_scaled(struct inv *inv, int size)
+{
+	const char *plane_name[] = { "axial", "sagittal", "coronal" };
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	int d = inv_get_num_images(inv);
+	int arr[] = { d, w, h }; // num images per plane
+	int big = max2(max2(w, h), d);
+	uint16_t *pix = malloc((size_t)big * big * sizeof(*pix));
+	int i;
+	
+	if (!pix)
+	{
+		fprintf(stderr, "memory error\n");
+		return;
+	}
+	
+	fprintf(stdout, "reslice to %dx%d or larger:\n", size, size);
+	for (i = 0; i < INV_PLANE_NUM; ++i)
+	{
+		double start = timer_now();
+		double elapsed;
+		int pw = 0;
+		int ph = 0;
+		int k;
+		
+		for (k = 0; k < arr[i]; ++k)
+			inv_get_plane_scaled(inv, pix, k, i, size, size, &pw, &ph);
+		
+		elapsed = timer_now() - start;
+		fprintf(stdout, "  %-8s %4dx%-4d %9.3f ms total %8.3f ms/slice\n"
+			, plane_name[i], pw, ph, elapsed * 1e3, elapsed * 1e3 / arr[i]
+		);
+	}
+	
+	free(pix);
+}
+
+/* time size*size oblique planes through the center, tilting a little further each time */
+static void bench_oblique(struct inv *inv, int num, int size)
+{
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	int d = inv_get_num_images(inv);
+	uint16_t *pix = malloc((size_t)size * size * sizeof(*pix));
+	double start;
+	double elapsed;
+	int i;
+	
+	if (!pix)
+	{
+		fprintf(stderr, "memory error\n");
+		return;
+	}
+	
+	start = timer_now();
+	for (i = 0; i < num; ++i)
+	{
+		float a = i * 0.05f;
+		float b = i * 0.03f;
+		float u[3] = { cosf(a), sinf(a), 0 };
+		float v[3] = { -sinf(a) * cosf(b), cosf(a) * cosf(b), sinf(b) };
+		float origin[3];
+		int k;
+		
+		for (k = 0; k < 3; ++k)
+			origin[k] = (k == 0 ? w : (k == 1 ? h : d)) * 0.5f - (u[k] + v[k]) * size * 0.5f;
+		
+		inv_get_oblique(inv, pix, origin, u, v, size, size);
+	}
+	elapsed = timer_now() - start;
+	
+	fprintf(stdout, "oblique %dx%d, %d planes:\n", size, size, num);
+	fprintf(stdout, "  trilinear %9.3f ms total %8.3f ms/plane\n", elapsed * 1e3, elapsed * 1e3 / num);
+	
+	free(pix);
+}
+
+/* time thick slabs of each mode, sliding one slice at a time as the viewer does */
+static void bench_slab(struct inv *inv, int thickness, int num)
+{
+	const char *plane_name[] = { "axial", "sagittal", "coronal" };
+	const char *mode_name[] = { "max", "min", "average" };
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	int d = inv_get_num_images(inv);
+	int arr[] = { d, w, h }; // num images per plane
+	int big = max2(max2(w, h), d);
+	uint16_t *pix = malloc((size_t)big * big * sizeof(*pix));
+	int i;
+	int m;
+	
+	if (!pix)
+	{
+		fprintf(stderr, "memory error\n");
+		return;
+	}
+	
+	fprintf(stdout, "slab of %d slices, sliding %d times:\n", thickness, num);
+	for (m = 0; m < INV_SLAB_NUM; ++m)
+	{
+		for (i = 0; i < INV_PLANE_NUM; ++i)
+		{
+			double start = timer_now();
+			double elapsed;
+			int k;
+			
+			for (k = 0; k < num; ++k)
+				inv_get_slab(inv, pix, (arr[i] / 4 + k) % arr[i], thickness, i, m);
+			
+			elapsed = timer_now() - start;
+			fprintf(stdout, "  %-7s %-8s %9.3f ms total %8.3f ms/slab\n"
+				, mode_name[m], plane_name[i], elapsed * 1e3, elapsed * 1e3 / num
+			);
+		}
+	}
+	
+	free(pix);
+}
+
+/* time estimating a dental arch, then panoramic views along it of each thickness */
+static void bench_panoramic(struct inv *inv, int num)
+{
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	int d = inv_get_num_images(inv);
+	float arch[9 * 2];
+	uint16_t *pix;
+	double start;
+	double elapsed;
+	int pw;
+	int t;
+	int i;
+	
+	start = timer_now();
+	if (inv_estimate_arch(inv, d / 2, 30, arch, 9))
+	{
+		/* not a dental volume, so any arch will do */
+		for (i = 0; i < 9; ++i)
+		{
+			float a = 3.14159265f * i / 8;
+			
+			arch[i * 2] = w * (0.5f - 0.4f * cosf(a));
+			arch[i * 2 + 1] = h * (0.5f - 0.4f * sinf(a));
+		}
+	}
+	elapsed = timer_now() - start;
+	pw = ceilf(inv_arch_length(arch, 9));
+	
+	if (!(pix = malloc((size_t)(pw < 1 ? 1 : pw) * d * sizeof(*pix))))
+	{
+		fprintf(stderr, "memory error\n");
+		return;
+	}
+	
+	fprintf(stdout, "panoramic %dx%d, %d times:\n", pw, d, num);
+	fprintf(stdout, "  estimate arch %9.3f ms\n", elapsed * 1e3);
+	for (t = 1; t <= 16; t *= 4)
+	{
+		start = timer_now();
+		for (i = 0; i < num; ++i)
+			inv_get_panoramic(inv, pix, arch, 9, t, pw, d);
+		elapsed = timer_now() - start;
+		fprintf(stdout, "  %2d voxels     %9.3f ms total %8.3f ms/view\n", t, elapsed * 1e3, elapsed * 1e3 / num);
+	}
+	
+	free(pix);
+}
+
+/* time rendering the volume from a slowly turning camera, at full and at dragging (1/4) resolution */
+static void bench_render(struct inv *inv, int num, int size)
+{
+	const char *mode_name[] = { "mip", "dvr" };
+	struct inv_render *r = inv_render_new(inv, true);
+	uint8_t *rgb = malloc((size_t)size * size * 3);
+	int m;
+	
+	if (!r || !rgb)
+	{
+		fprintf(stderr, "memory error\n");
+		inv_render_free(r);
+		free(rgb);
+		return;
+	}
+	
+	inv_render_set_shading(r, 0, 255, -1);
+	fprintf(stdout, "render, %d views:\n", num);
+	for (m = 0; m < INV_RENDER_NUM; ++m)
+	{
+		int s;
+		
+		for (s = size; s >= size / 4; s /= 4)
+		{
+			double start = timer_now();
+			double elapsed;
+			int k;
+			
+			for (k = 0; k < num; ++k)
+				inv_render_draw(r, rgb, s, s, k * 0.1f, k * 0.05f, m);
+			
+			elapsed = timer_now() - start;
+			fprintf(stdout, "  %s %4dx%-4d %9.3f ms total %8.3f ms/view\n"
+				, mode_name[m], s, s, elapsed * 1e3, elapsed * 1e3 / num
+			);
+		}
+	}
+	
+	inv_render_free(r);
+	free(rgb);
+}
+
+/* inv_make_8bit as it was before it used a lookup table: the float
+ * brightness/contrast pipeline, then the thresholds, for every pixel
+ */
+static void make_8bit_float(uint16_t *pixels, int num, int threshold_min, int threshold_max)
+{
+	uint8_t *dst = (uint8_t*)pixels;
+	int i;
+	
+	for (i = 0; i < num; ++i)
+	{
+		float brightness = -0.23;
+		float contrast = 17.500031;
+		float conv = pixels[i] * (1.0f / 65535.0f);
+		uint8_t shade;
+		
+		conv -= 0.5f;
+		conv *= contrast;
+		conv += brightness;
+		conv += 0.5f;
+		if (conv < 0)
+			conv = 0;
+		if (conv > 1)
+			conv = 1;
+		conv *= 255;
+		shade = conv;
+		
+		dst[i] = (shade < threshold_min || shade > threshold_max) ? 0 : shade;
+	}
+}
+
+/* time inv_make_8bit against the float pipeline on the middle axial
+ * slice, after checking that both shade every sample value alike
+ */
+static void bench_make_8bit(struct inv *inv, int num)
+{
+	const int threshold[][2] = { { 0, 255 }, { 20, 200 }, { 128, 128 } };
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	size_t sz = (size_t)max2(w * h, 65536) * sizeof(uint16_t);
+	uint16_t *slice = malloc(sz);
+	uint16_t *a = malloc(sz);
+	uint16_t *b = malloc(sz);
+	int mismatch = 0;
+	int i;
+	int k;
+	
+	if (!slice || !a || !b)
+	{
+		fprintf(stderr, "memory error\n");
+		goto L_cleanup;
+	}
+	
+	for (k = 0; k < (int)(sizeof(threshold) / sizeof(*threshold)); ++k)
+	{
+		for (i = 0; i < 65536; ++i)
+			a[i] = b[i] = i;
+		make_8bit_float(a, 65536, threshold[k][0], threshold[k][1]);
+		inv_make_8bit(b, 65536, 1, threshold[k][0], threshold[k][1]);
+		mismatch += memcmp(a, b, 65536) != 0;
+	}
+	
+	inv_get_plane(inv, slice, inv_get_num_images(inv) / 2, INV_PLANE_AXIAL);
+	fprintf(stdout, "make 8-bit %dx%d, %d slices (%s the float pipeline):\n"
+		, w, h, num, mismatch ? "MISMATCHES" : "identical to"
+	);
+	for (k = 0; k < 2; ++k)
+	{
+		double start = timer_now();
+		double elapsed;
+		
+		for (i = 0; i < num; ++i)
+		{
+			memcpy(a, slice, (size_t)w * h * sizeof(*slice));
+			if (k)
+				inv_make_8bit(a, w, h, 20, 255);
+			else
+				make_8bit_float(a, w * h, 20, 255);
+		}
+		
+		elapsed = timer_now() - start;
+		fprintf(stdout, "  %-5s %9.3f ms total %8.3f ms/slice\n"
+			, k ? "table" : "float", elapsed * 1e3, elapsed * 1e3 / num
+		);
+	}
+	
+L_cleanup:
+	free(slice);
+	free(a);
+	free(b);
+}
+
+/* time counting the samples in [lo, hi], by full scan and by min/max summary */
+static void bench_count(struct inv *inv, int lo, int hi)
+{
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	int d = inv_get_num_images(inv);
+	int bps = inv_get_bytes_per_sample(inv);
+	uint16_t *pix = malloc((size_t)w * h * sizeof(*pix));
+	const uint8_t *pix8 = (const uint8_t*)pix;
+	size_t scanned = 0;
+	size_t skipped;
+	double start;
+	double scanTime;
+	double skipTime;
+	int i;
+	int k;
+	
+	if (!pix)
+	{
+		fprintf(stderr, "memory error\n");
+		return;
+	}
+	
+	start = timer_now();
+	for (k = 0; k < d; ++k)
+	{
+		inv_get_plane(inv, pix, k, INV_PLANE_AXIAL);
+		for (i = 0; i < w * h; ++i)
+		{
+			int v = bps == 1 ? pix8[i] : pix[i];
+			
+			scanned += v >= lo && v <= hi;
+		}
+	}
+	scanTime = timer_now() - start;
+	
+	start = timer_now();
+	skipped = inv_count_in_range(inv, lo, hi);
+	skipTime = timer_now() - start;
+	
+	fprintf(stdout, "count in [%d,%d]:\n", lo, hi);
+	fprintf(stdout, "  full scan %12zu samples %9.3f ms\n", scanned, scanTime * 1e3);
+	fprintf(stdout, "  summary   %12zu samples %9.3f ms\n", skipped, skipTime * 1e3);
+	
+	free(pix);
+}
+
+/* time building a 1-bit mask of the samples in [lo, hi], then counting it
+ * (and check the count against the samples that are in range)
+ */
+static void bench_mask(struct inv *inv, int lo, int hi)
+{
+	struct inv_mask *mask;
+	double start = timer_now();
+	double buildTime;
+	double countTime;
+	size_t count;
+	size_t expect;
+	
+	if (!(mask = inv_threshold_mask(inv, lo, hi)))
+		return;
+	buildTime = timer_now() - start;
+	
+	start = timer_now();
+	count = inv_mask_count(mask);
+	countTime = timer_now() - start;
+	
+	fprintf(stdout, "mask of [%d,%d]:\n", lo, hi);
+	fprintf(stdout, "  threshold %12s         %9.3f ms\n", "", buildTime * 1e3);
+	fprintf(stdout, "  popcount  %12zu samples %9.3f ms\n", count, countTime * 1e3);
+	
+	expect = inv_count_in_range(inv, lo, hi);
+	if (count != expect)
+		fprintf(stderr, "  mask mismatch: %zu samples, expected %zu\n", count, expect);
+	
+	inv_mask_free(mask);
+}
+
+/* time a point cloud export of the shades in [minv, maxv], skipping
+ * the summary blocks with nothing to emit, and without skipping (a
+ * view of the whole volume has no summary); the output is discarded
+ */
+static void bench_points(struct inv *inv, int minv, int maxv, float density)
+{
+	const char *fn = "bench-points.ply";
+	struct inv *view;
+	double start;
+	double skipTime;
+	double scanTime;
+	
+	if (!(view = inv_view(inv, 0, 0, 0, inv_get_width(inv), inv_get_height(inv), inv_get_num_images(inv))))
+		return;
+	
+	start = timer_now();
+	if (inv_dump_pointcloud(inv, fn, minv, maxv, -1, density, 0))
+		goto L_cleanup;
+	skipTime = timer_now() - start;
+	
+	start = timer_now();
+	if (inv_dump_pointcloud(view, fn, minv, maxv, -1, density, 0))
+		goto L_cleanup;
+	scanTime = timer_now() - start;
+	
+	fprintf(stdout, "points of shades [%d,%d], density %.2f:\n", minv, maxv, density);
+	fprintf(stdout, "  full scan %9.3f ms\n", scanTime * 1e3);
+	fprintf(stdout, "  summary   %9.3f ms\n", skipTime * 1e3);
+	
+L_cleanup:
+	remove(fn);
+	inv_free(view);
+}
+
+/* time taking a snapshot of a bricked volume, then editing every
+ * eighth brick of it (a threshold filter), as a processing variant would
+ */
+static void bench_snapshot(struct inv *inv)
+{
+	struct inv *snap;
+	double start = timer_now();
+	double snapTime;
+	double editTime;
+	size_t brickSz;
+	size_t edited = 0;
+	size_t total;
+	int dim;
+	int nx;
+	int ny;
+	int nz;
+	int i;
+	
+	inv_get_brick_grid(inv, &dim, &nx, &ny, &nz);
+	if (!dim || !(snap = inv_snapshot(inv)))
+		return;
+	snapTime = timer_now() - start;
+	
+	total = (size_t)nx * ny * nz;
+	brickSz = (size_t)dim * dim * dim * sizeof(uint16_t);
+	start = timer_now();
+	for (i = 0; i < (int)total; i += 8)
+	{
+		int x = i % nx * dim;
+		int y = i / nx % ny * dim;
+		int z = i / nx / ny * dim;
+		uint16_t *brick = inv_edit_brick(snap, x / dim, y / dim, z / dim);
+		int k;
+		
+		if (!brick)
+			break;
+		for (k = 0; k < dim * dim * dim; ++k)
+			brick[k] = brick[k] < 32768 ? 0 : brick[k];
+		inv_update_ranges(snap, x, y, z, x + dim, y + dim, z + dim);
+		edited += 1;
+	}
+	editTime = timer_now() - start;
+	
+	fprintf(stdout, "snapshot of %zu bricks:\n", total);
+	fprintf(stdout, "  snapshot  %9.3f ms, +%.1f MiB (a full copy is %.1f MiB)\n"
+		, snapTime * 1e3, (double)total * sizeof(void*) / (1 << 20), (double)total * brickSz / (1 << 20)
+	);
+	fprintf(stdout, "  edit      %9.3f ms, %zu bricks copied, +%.1f MiB\n"
+		, editTime * 1e3, edited, (double)edited * brickSz / (1 << 20)
+	);
+	
+	inv_free(snap);
+}
+
+/* time box statistics, by direct scan and by summed-volume table */
+static void bench_box_stats(struct inv *inv, int num, int size)
+{
+	int w = inv_get_width(inv);
+	int h = inv_get_height(inv);
+	int d = inv_get_num_images(inv);
+	int bps = inv_get_bytes_per_sample(inv);
+	uint32_t seed = 1;
+	double scanMean = 0;
+	double tableMean = 0;
+	double scanTime = 0;
+	double tableTime = 0;
+	int i;
+	
+	if (inv_box_stats(inv, 0, 0, 0, 1, 1, 1, 0, 0, 0))
+		return;
+	
+	for (i = 0; i < num; ++i)
+	{
+		int box[6];
+		double start;
+		double mean;
+		uint64_t sum = 0;
+		size_t n = 0;
+		int x;
+		int y;
+		int z;
+		int k;
+		
+		/* same boxes on every run (a small LCG) */
+		for (k = 0; k < 3; ++k)
+		{
+			int dim = k == 0 ? w : (k == 1 ? h : d);
+			int span;
+			
+			seed = seed * 1664525u + 1013904223u;
+			span = 1 + (seed >> 8) % size;
+			if (span > dim)
+				span = dim;
+			seed = seed * 1664525u + 1013904223u;
+			box[k] = (seed >> 8) % (dim - span + 1);
+			box[k + 3] = box[k] + span;
+		}
+		
+		start = timer_now();
+		for (z = box[2]; z < box[5]; ++z)
+			for (y = box[1]; y < box[4]; ++y)
+				for (x = box[0]; x < box[3]; ++x, ++n)
+					sum += bps == 1 ? inv_get_sample8(inv, x, y, z) : inv_get_sample16(inv, x, y, z);
+		scanTime += timer_now() - start;
+		scanMean += (double)sum / n;
+		
+		start = timer_now();
+		inv_box_stats(inv, box[0], box[1], box[2], box[3], box[4], box[5], 0, &mean, 0);
+		tableTime += timer_now() - start;
+		tableMean += mean;
+	}
+	
+	fprintf(stdout, "box stats, %d boxes up to %d^3:\n", num, size);
+	fprintf(stdout, "  full scan %12.3f mean %9.3f ms %8.4f ms/box\n", scanMean / num, scanTime * 1e3, scanTime * 1e3 / num);
+	fprintf(stdout, "  table     %12.3f mean %9.3f ms %8.4f ms/box\n", tableMean / num, tableTime * 1e3, tableTime * 1e3 / num);
+}
+
+/* runs every benchmark against a loaded volume, printing results to stdout */
+void bench_run(struct inv *inv)
+{
+	assert(inv);
+	
+	bench_reslice(inv);
+	bench_reslice_scaled(inv, 128);
+	bench_oblique(inv, 100, 512);
+	bench_slab(inv, 30, 40);
+	bench_panoramic(inv, 10);
+	bench_render(inv, 10, 512);
+	if (inv_get_bytes_per_sample(inv) == 1)
+	{
+		bench_count(inv, 128, 255);
+		bench_mask(inv, 128, 255);
+		bench_mask(inv, 160, 1000);
+	}
+	else
+	{
+		bench_count(inv, 32768, 65535);
+		bench_mask(inv, 32768, 65535);
+		bench_mask(inv, 40000, 70000);
+		bench_make_8bit(inv, 100);
+	}
+	bench_points(inv, 200, 255, 0.5);
+	bench_box_stats(inv, 256, 64);
+	bench_snapshot(inv);
+}
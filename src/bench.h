@@ -0,0 +1,8 @@
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+struct inv;
+
+void bench_run(struct inv *inv);
+
+#endif /* BENCH_H_INCLUDED */
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "check.h"
+#include "inv.h"
+#include "common.h"
+
+/* dimensions of the synthetic volume: more than 2^31 samples, and more
+ * than 2^31 bytes (4.06 GiB), so every size and offset needs 64 bits
+ */
+#define CHECK_W 2048
+#define CHECK_H 1024
+#define CHECK_D 1040
+
+/* every sample at x and y multiples of this is the brightest shade */
+#define CHECK_BRIGHT_STEP 256
+
+static int max2(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+/* the synthetic sample at (x, y, z); all but the bright ones shade to 0 */
+static uint16_t check_sample(int x, int y, int z)
+{
+	if (!(x % CHECK_BRIGHT_STEP) && !(y % CHECK_BRIGHT_STEP))
+		return UINT16_MAX;
+	
+	return (x * 3 + y * 5 + z * 7) & 0x3fff;
+}
+
+/* number of bright samples in the synthetic volume */
+static size_t check_bright_num(void)
+{
+	size_t nx = (CHECK_W + CHECK_BRIGHT_STEP - 1) / CHECK_BRIGHT_STEP;
+	size_t ny = (CHECK_H + CHECK_BRIGHT_STEP - 1) / CHECK_BRIGHT_STEP;
+	
+	return nx * ny * CHECK_D;
+}
+
+/* fills one axial frame of the synthetic volume */
+static void check_frame(uint16_t *dst, int z)
+{
+	int x;
+	int y;
+	
+	for (y = 0; y < CHECK_H; ++y)
+		for (x = 0; x < CHECK_W; ++x)
+			*dst++ = check_sample(x, y, z);
+}
+
+/* writes the synthetic volume as raw 16-bit little-endian frames (see --dump) */
+static int check_write(const char *fn, uint16_t *frame)
+{
+	FILE *fp;
+	int z;
+	
+	if (!(fp = fopen(fn, "wb")))
+	{
+		fprintf(stderr, "failed to open '%s' for writing\n", fn);
+		return 1;
+	}
+	
+	for (z = 0; z < CHECK_D; ++z)
+	{
+		check_frame(frame, z);
+		if (!fwriteLEu16(frame, (size_t)CHECK_W * CHECK_H, fp))
+		{
+			fprintf(stderr, "error writing file '%s'\n", fn);
+			fclose(fp);
+			return 1;
+		}
+	}
+	
+	if (fclose(fp))
+	{
+		fprintf(stderr, "error writing file '%s'\n", fn);
+		return 1;
+	}
+	
+	return 0;
+}
+
+/* compares single samples, at the corners and past 2^31 */
+static int check_samples(struct inv *inv)
+{
+	const int at[][3] = {
+		{ 0, 0, 0 }
+		, { CHECK_W - 1, 0, 0 }
+		, { 0, CHECK_H - 1, 0 }
+		, { 0, 0, CHECK_D - 1 }
+		, { 1, 2, (int)(((size_t)1 << 31) / ((size_t)CHECK_W * CHECK_H)) }
+		, { 1, 2, CHECK_D - 2 }
+		, { CHECK_W - 1, CHECK_H - 1, CHECK_D - 1 }
+	};
+	int i;
+	
+	for (i = 0; i < (int)(sizeof(at) / sizeof(*at)); ++i)
+	{
+		int x = at[i][0];
+		int y = at[i][1];
+		int z = at[i][2];
+		
+		if (inv_get_sample16(inv, x, y, z) != check_sample(x, y, z))
+		{
+			fprintf(stderr, "sample %d,%d,%d is %d, expected %d\n"
+				, x, y, z, inv_get_sample16(inv, x, y, z), check_sample(x, y, z)
+			);
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+/* compares the last axial, sagittal and coronal planes (see inv_get_plane
+ * for their orientations), each of which reads samples past 2^31
+ */
+static int check_planes(struct inv *inv, uint16_t *pix)
+{
+	int x;
+	int y;
+	int z;
+	
+	inv_get_plane(inv, pix, CHECK_D - 1, INV_PLANE_AXIAL);
+	for (y = 0; y < CHECK_H; ++y)
+		for (x = 0; x < CHECK_W; ++x)
+			if (pix[y * CHECK_W + x] != check_sample(x, y, CHECK_D - 1))
+				goto L_axial;
+	
+	inv_get_plane(inv, pix, CHECK_W - 1, INV_PLANE_SAGITTAL);
+	for (z = 0; z < CHECK_D; ++z)
+		for (y = 0; y < CHECK_H; ++y)
+			if (pix[CHECK_D * CHECK_H - 1 - (z * CHECK_H + y)] != check_sample(CHECK_W - 1, y, z))
+				goto L_sagittal;
+	
+	inv_get_plane(inv, pix, CHECK_H - 1, INV_PLANE_CORONAL);
+	for (z = 0; z < CHECK_D; ++z)
+		for (x = 0; x < CHECK_W; ++x)
+			if (pix[z * CHECK_W + x] != check_sample(x, CHECK_H - 1, CHECK_D - 1 - z))
+				goto L_coronal;
+	
+	return 0;
+	
+L_axial:
+	fprintf(stderr, "axial plane %d differs at %d,%d\n", CHECK_D - 1, x, y);
+	return 1;
+L_sagittal:
+	fprintf(stderr, "sagittal plane %d differs at %d,%d\n", CHECK_W - 1, y, z);
+	return 1;
+L_coronal:
+	fprintf(stderr, "coronal plane %d differs at %d,%d\n", CHECK_H - 1, x, z);
+	return 1;
+}
+
+/* writes the volume with inv_dump, then reads it back frame by frame */
+static int check_dump(struct inv *inv, const char *fn, uint16_t *frame, uint16_t *expect)
+{
+	size_t num = (size_t)CHECK_W * CHECK_H;
+	FILE *fp;
+	int z;
+	
+	if (inv_dump(inv, fn))
+		return 1;
+	
+	if (!(fp = fopen(fn, "rb")))
+	{
+		fprintf(stderr, "failed to open '%s' for reading\n", fn);
+		return 1;
+	}
+	
+	for (z = 0; z < CHECK_D; ++z)
+	{
+		if (fread(frame, sizeof(*frame), num, fp) != num)
+		{
+			fprintf(stderr, "'%s' ends at frame %d\n", fn, z);
+			fclose(fp);
+			return 1;
+		}
+		LEu16_inplace(frame, num);
+		check_frame(expect, z);
+		if (memcmp(frame, expect, num * sizeof(*frame)))
+		{
+			fprintf(stderr, "'%s' differs in frame %d\n", fn, z);
+			fclose(fp);
+			return 1;
+		}
+	}
+	
+	if (fgetc(fp) != EOF)
+	{
+		fprintf(stderr, "'%s' is longer than the volume\n", fn);
+		fclose(fp);
+		return 1;
+	}
+	
+	fclose(fp);
+	
+	return 0;
+}
+
+/* exports the bright samples as a point cloud, then checks its vertex
+ * count and its last vertex (the last bright sample, in slice order)
+ */
+static int check_points(struct inv *inv, const char *fn)
+{
+	char buf[512];
+	const char *line;
+	size_t num = 0;
+	size_t got;
+	float xyz[3] = {-1, -1, -1};
+	float last[3] = {
+		(CHECK_W - 1) / CHECK_BRIGHT_STEP * CHECK_BRIGHT_STEP
+		, (CHECK_H - 1) / CHECK_BRIGHT_STEP * CHECK_BRIGHT_STEP
+		, CHECK_D - 1
+	};
+	FILE *fp;
+	
+	if (inv_dump_pointcloud(inv, fn, 128, 255, -1, 1, 0))
+		return 1;
+	
+	if (!(fp = fopen(fn, "rb")))
+	{
+		fprintf(stderr, "failed to open '%s' for reading\n", fn);
+		return 1;
+	}
+	
+	/* the vertex count, from the header */
+	got = fread(buf, 1, sizeof(buf) - 1, fp);
+	buf[got] = '\0';
+	if ((line = strstr(buf, "element vertex ")))
+		sscanf(line, "element vertex %zu", &num);
+	
+	/* the last line */
+	if (!fseek64(fp, -(int64_t)(sizeof(buf) - 1), SEEK_END))
+	{
+		got = fread(buf, 1, sizeof(buf) - 1, fp);
+		buf[got] = '\0';
+		while (got && buf[got - 1] == '\n')
+			buf[--got] = '\0';
+		if ((line = strrchr(buf, '\n')))
+			sscanf(line + 1, "%f %f %f", &xyz[0], &xyz[1], &xyz[2]);
+	}
+	
+	fclose(fp);
+	
+	if (num != check_bright_num())
+	{
+		fprintf(stderr, "'%s' holds %zu vertices, expected %zu\n", fn, num, check_bright_num());
+		return 1;
+	}
+	if (memcmp(xyz, last, sizeof(xyz)))
+	{
+		fprintf(stderr, "'%s' ends at %f,%f,%f, expected %f,%f,%f\n"
+			, fn, xyz[0], xyz[1], xyz[2], last[0], last[1], last[2]
+		);
+		return 1;
+	}
+	
+	return 0;
+}
+
+/* returns true if a file already exists at 'fn' */
+static bool check_exists(const char *fn)
+{
+	FILE *fp;
+	
+	if (!(fp = fopen(fn, "rb")))
+		return false;
+	
+	fclose(fp);
+	
+	return true;
+}
+
+/* reports a check's result and time, and passes the result along */
+static int check_report(const char *name, int result, double start)
+{
+	fprintf(stdout, "  %-10s %s %9.3f s\n", name, result ? "FAILED" : "ok    ", timer_now() - start);
+	
+	return result;
+}
+
+/* writes a synthetic volume larger than 2^31 samples and 2^31 bytes to
+ * 'fn', then loads it with the given options and checks single samples,
+ * reslicing, a --dump round trip and a --points export against it
+ * (also written next to 'fn', as 'fn'.dump and 'fn'.ply); none of the
+ * three may exist beforehand, and every file made is removed again;
+ * returns non-zero if a check fails
+ */
+int check_large(const char *fn, const struct inv_opts *opts)
+{
+	size_t fnSz;
+	size_t frameNum = (size_t)CHECK_W * CHECK_H;
+	int big = max2(max2(CHECK_W, CHECK_H), CHECK_D);
+	char *dumpFn = 0;
+	char *plyFn = 0;
+	uint16_t *frame = 0;
+	uint16_t *expect = 0;
+	uint16_t *pix = 0;
+	struct inv *inv = 0;
+	bool isWritten = false; // files this run made, so only those are removed
+	bool isDumped = false;
+	bool isExported = false;
+	double start;
+	int rval = 1;
+	
+	assert(fn);
+	
+	if (opts && opts->is8bit)
+	{
+		fprintf(stderr, "the large volume check needs 16-bit samples (no --8bit)\n");
+		return 1;
+	}
+	
+	fnSz = strlen(fn) + 16;
+	dumpFn = malloc(fnSz);
+	plyFn = malloc(fnSz);
+	frame = malloc(frameNum * sizeof(*frame));
+	expect = malloc(frameNum * sizeof(*expect));
+	pix = malloc((size_t)big * big * sizeof(*pix));
+	if (!dumpFn || !plyFn || !frame || !expect || !pix)
+	{
+		fprintf(stderr, "memory error\n");
+		goto L_cleanup;
+	}
+	
+	snprintf(dumpFn, fnSz, "%s.dump", fn);
+	snprintf(plyFn, fnSz, "%s.ply", fn);
+	
+	/* never overwrite (or later remove) anything already there */
+	if (check_exists(fn) || check_exists(dumpFn) || check_exists(plyFn))
+	{
+		fprintf(stderr, "'%s', '%s' or '%s' already exists; not overwriting it\n", fn, dumpFn, plyFn);
+		goto L_cleanup;
+	}
+	
+	fprintf(stdout, "large volume %dx%dx%d, %zu samples:\n"
+		, CHECK_W, CHECK_H, CHECK_D, frameNum * CHECK_D
+	);
+	
+	start = timer_now();
+	isWritten = true;
+	if (check_report("write", check_write(fn, frame), start))
+		goto L_cleanup;
+	
+	start = timer_now();
+	inv = inv_load_binary(fn, CHECK_W, CHECK_H, opts);
+	if (check_report("load", !inv
+			|| inv_get_width(inv) != CHECK_W
+			|| inv_get_height(inv) != CHECK_H
+			|| inv_get_num_images(inv) != CHECK_D
+			|| inv_get_bytes_per_sample(inv) != 2
+		, start)
+	)
+		goto L_cleanup;
+	
+	start = timer_now();
+	if (check_report("samples", check_samples(inv), start))
+		goto L_cleanup;
+	
+	start = timer_now();
+	if (check_report("reslice", check_planes(inv, pix), start))
+		goto L_cleanup;
+	
+	start = timer_now();
+	isDumped = true;
+	if (check_report("dump", check_dump(inv, dumpFn, frame, expect), start))
+		goto L_cleanup;
+	
+	start = timer_now();
+	isExported = true;
+	if (check_report("points", check_points(inv, plyFn), start))
+		goto L_cleanup;
+	
+	rval = 0;
+L_cleanup:
+	if (inv)
+		inv_free(inv);
+	if (isWritten)
+		remove(fn);
+	if (isDumped)
+		remove(dumpFn);
+	if (isExported)
+		remove(plyFn);
+	free(dumpFn);
+	free(plyFn);
+	free(frame);
+	free(expect);
+	free(pix);
+	return rval;
+}
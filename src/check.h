@@ -0,0 +1,8 @@
+#ifndef CHECK_H_INCLUDED
+#define CHECK_H_INCLUDED
+
+struct inv_opts;
+
+int check_large(const char *fn, const struct inv_opts *opts);
+
+#endif /* CHECK_H_INCLUDED */
@@ -1,10 +1,57 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime, fseeko */
+#define _FILE_OFFSET_BITS 64 /* 64-bit off_t where long is 32-bit */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+
+#ifdef _WIN32
+#	include <windows.h>
+#endif
 
 #include "common.h"
 
+/* monotonic wall-clock time in seconds, for timing things */
+double timer_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	
+	return (double)now.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* fseek and ftell with 64-bit offsets, for files above 2 GiB */
+int fseek64(FILE *fp, int64_t offset, int whence)
+{
+#ifdef _WIN32
+	return _fseeki64(fp, offset, whence);
+#else
+	return fseeko(fp, offset, whence);
+#endif
+}
+
+int64_t ftell64(FILE *fp)
+{
+#ifdef _WIN32
+	return _ftelli64(fp);
+#else
+	return ftello(fp);
+#endif
+}
+
 /* read little-endian encoded u32 */
 uint32_t LEu32(const void *ptr)
 {
@@ -34,6 +81,68 @@ void fputLEu32(const uint32_t v, FILE *fp)
 	fputc(v >> 24, fp);
 }
 
+/* convert an array of u16 between native and little-endian byte order
+ * (byteswapping is its own inverse, so this works in either direction)
+ */
+void LEu16_inplace(uint16_t *dat, size_t num)
+{
+	const uint16_t one = 1;
+	size_t i;
+	
+	/* nothing to do on little-endian hosts */
+	if (*((const uint8_t*)&one))
+		return;
+	
+	for (i = 0; i < num; ++i)
+		dat[i] = (dat[i] << 8) | (dat[i] >> 8);
+}
+
+/* write an array of native u16 to a file in little-endian byte order
+ * returns 0 on failure
+ * returns non-zero on success
+ */
+int fwriteLEu16(const uint16_t *dat, size_t num, FILE *fp)
+{
+	uint16_t buf[4096];
+	size_t i;
+	
+	/* converted in chunks, so the source is left untouched */
+	for (i = 0; i < num; )
+	{
+		size_t n = num - i;
+		
+		if (n > sizeof(buf) / sizeof(*buf))
+			n = sizeof(buf) / sizeof(*buf);
+		
+		memcpy(buf, dat + i, n * sizeof(*buf));
+		LEu16_inplace(buf, n);
+		
+		if (fwrite(buf, sizeof(*buf), n, fp) != n)
+			return 0;
+		
+		i += n;
+	}
+	
+	return 1;
+}
+
+/* savefile() for arrays of native u16, written in little-endian byte order */
+int savefileLEu16(const char *fn, const uint16_t *dat, size_t num)
+{
+	FILE *fp;
+	
+	if (!fn || !dat || !num || !(fp = fopen(fn, "wb")))
+		return 0;
+	
+	if (!fwriteLEu16(dat, num, fp))
+	{
+		fclose(fp);
+		return 0;
+	}
+	
+	return !fclose(fp);
+}
+
 /* memchr copy-pasted from Android Bionic
  * https://android.googlesource.com/platform/bionic/+/ics-mr0/libc/string/memchr.c
  */
@@ -138,6 +247,7 @@ void *memduppad(const void *mem, size_t sz, size_t padbytes)
 void *loadfile(const char *fn, size_t *sz)
 {
 	FILE *fp;
+	int64_t end;
 	void *dat;
 	
 	/* rudimentary error checking returns 0 on any error */
@@ -145,9 +255,11 @@ void *loadfile(const char *fn, size_t *sz)
 		!fn
 		|| !sz
 		|| !(fp = fopen(fn, "rb"))
-		|| fseek(fp, 0, SEEK_END)
-		|| !(*sz = ftell(fp))
-		|| fseek(fp, 0, SEEK_SET)
+		|| fseek64(fp, 0, SEEK_END)
+		|| (end = ftell64(fp)) <= 0
+		|| (uint64_t)end > SIZE_MAX
+		|| !(*sz = end)
+		|| fseek64(fp, 0, SEEK_SET)
 		|| !(dat = malloc(*sz))
 		|| fread(dat, 1, *sz, fp) != *sz
 		|| fclose(fp)
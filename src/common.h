@@ -1,11 +1,14 @@
 #ifndef COMMON_H_INCLUDED
 #define COMMON_H_INCLUDED
 
+#include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
 
 int savefile(const char *fn, const void *dat, const size_t sz);
 void *loadfile(const char *fn, size_t *sz);
+int fseek64(FILE *fp, int64_t offset, int whence);
+int64_t ftell64(FILE *fp);
 void *memdup(const void *mem, size_t sz);
 void *memduppad(const void *mem, size_t sz, size_t padbytes);
 void *memchr(const void *mem, int c, size_t memSz);
@@ -16,5 +19,11 @@ void *memstr(const void *hay, size_t haySz, const char *needle);
 uint32_t LEu32(const void *ptr);
 uint32_t BEu32(const void *ptr);
 void fputLEu32(const uint32_t v, FILE *fp);
+void LEu16_inplace(uint16_t *dat, size_t num);
+int fwriteLEu16(const uint16_t *dat, size_t num, FILE *fp);
+int savefileLEu16(const char *fn, const uint16_t *dat, size_t num);
+
+/* timing */
+double timer_now(void);
 
 #endif /* COMMON_H_INCLUDED */
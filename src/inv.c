@@ -13,10 +13,16 @@
 #include <jasper/jasper.h>
 #include <base64.h>
 #include <stb_image.h>
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
 
 #include "inv.h"
 #include "common.h"
 #include "palette.h"
+#include "thread.h"
+#include "alloc.h"
+#include "mask.h"
 
 /* fallback if no threading is available */
 #if defined(WANT_THREADS) && !defined(JAS_THREADS)
@@ -24,6 +30,19 @@
 #	undef WANT_THREADS
 #endif
 
+/* edge length of the blocks summarized by the min/max grid */
+#define RANGE_SHIFT 4
+#define RANGE_DIM (1 << RANGE_SHIFT)
+
+/* compressed bricks are coded in groups of this many samples */
+#define PACK_GROUP 64
+
+/* memory budget for decompressed bricks of a compressed volume */
+#define BRICK_CACHE_SZ (32 << 20)
+
+/* number of mip pyramid levels below full resolution (2x, 4x, 8x) */
+#define INV_LEVEL_NUM 3
+
 struct inv
 {
 	void *data;
@@ -38,26 +57,206 @@ struct inv
 	char ImageDate[512];
 	
 	/* AppendedData contents */
-	void *gray; // 16-bit grayscale image strip
-	void *grayEnd; // end of gray, for bounds checking
+	uint16_t *gray; // 16-bit grayscale image strip (native byte order)
+	uint8_t *gray8; // 8-bit image strip, used instead of gray for 8-bit volumes
+	void *grayEnd; // end of gray (or gray8), for bounds checking
+	uint8_t *gray12; // 12-bit packed samples, used instead of gray (see Pack12)
+	size_t gray12RowSz; // bytes per packed row
+	int gray12Base; // gray12 holds (sample - gray12Base) >> gray12Shift
+	int gray12Shift;
 	uint32_t *grayJPCsz; // size of each JPC container
 	size_t graySz; // size of gray memory block
 	unsigned grayNum; // number of images in strip
 	unsigned grayJPC; // number of JPC containers
 	int grayWidth; // dimensions of grayscale images
 	int grayHeight;
+	int grayBps; // bytes per sample (2, or 1 for 8-bit volumes)
+	
+	/* optional sagittal-major and coronal-major copies, stored exactly as
+	 * inv_get_plane returns them (indexed by enum inv_plane; axial unused)
+	 */
+	uint8_t *grayPlane[INV_PLANE_NUM];
+	
+	/* optional mip pyramid; level[n] is the volume downscaled by 2^(n+1) */
+	struct inv *level[INV_LEVEL_NUM];
+	
+	/* optional summed-volume table of (w+1)*(h+1)*(d+1) entries; entry
+	 * (x, y, z) sums the samples (and their squares) in [0,x)*[0,y)*[0,z)
+	 */
+	struct invSum
+	{
+		uint64_t sum;
+		uint64_t sq;
+	} *sums;
+	
+	/* optional intensity index: the position (x + (y + z * h) * w) of
+	 * every sample, ordered by value, then by position; the samples with
+	 * value v are index[indexStart[v]] .. index[indexStart[v + 1] - 1]
+	 */
+	uint32_t *index;
+	size_t *indexStart;
+	
+	/* running sums of each plane's last average slab (see inv_get_slab) */
+	struct invSlab
+	{
+		uint32_t *sum;
+		int lo; // slices [lo, hi) are summed
+		int hi;
+	} slab[INV_PLANE_NUM];
+	
+	/* views (see inv_view) read a box of their parent's samples */
+	struct inv *parent;
+	int viewX; // origin of the box within the parent
+	int viewY;
+	int viewZ;
+	uint8_t *viewPlane; // scratch parent plane for GetPlaneView
+	
+	/* min/max summary of every RANGE_DIM^3 block, for skipping empty space */
+	struct invRange
+	{
+		uint16_t min;
+		uint16_t max;
+	} *range;
+	int rangeX; // number of summary blocks along each axis
+	int rangeY;
+	int rangeZ;
+	
+	/* bricked layout, used instead of gray when brick != 0 */
+	uint16_t **brick; // brickDim^3 samples per brick, x varies fastest (see BrickNew)
+	int brickDim; // brick edge length (a power of two; requested size until brick != 0)
+	int brickShift; // log2(brickDim)
+	int brickX; // number of bricks along each axis
+	int brickY;
+	int brickZ;
+	
+	/* compressed bricks (see PackBrick); brick[n] is 0 for packed bricks,
+	 * which are decoded on demand into a direct-mapped cache
+	 */
+	uint64_t **brickPacked;
+	struct invBrickCache
+	{
+		size_t index; // index of the cached brick (SIZE_MAX = none)
+		uint16_t *data;
+	} *brickCache;
+	size_t brickCacheNum;
+	FILE *brickFile; // out-of-core brick store, brickDim^3 samples per brick
+	size_t brickStoreSz; // bytes of packed or stored bricks
+	size_t residentSz; // out-of-core resident set limit, in bytes (0 = in memory)
+	
+	int windowCenter; // window used for 8-bit volumes
+	int windowWidth;
 	bool isThreaded; // is threading enabled
+	bool hasHugePages; // voxel strip is on huge pages, placed by first touch
+	bool isInterleaved; // voxel strip is interleaved across NUMA nodes
 	int cmpno;
 };
 
+/* out-of-core volumes are loaded straight into the disk brick store,
+ * one slice at a time, and never held in memory in full
+ */
+static inline bool IsStreamed(const struct inv *inv)
+{
+	return inv->residentSz && inv->grayBps == 2;
+}
+
+/* returns whichever image strip the volume uses, as bytes */
+static uint8_t *GetStrip(const struct inv *inv)
+{
+	if (inv->grayBps == 1)
+		return inv->gray8;
+	
+	return (uint8_t*)inv->gray;
+}
+
+/* in-memory bricks keep a reference count just ahead of their samples,
+ * so that snapshots (see inv_snapshot) can share them
+ */
+#define BRICK_HEAD 16
+
+static inline unsigned *BrickRefs(uint16_t *brick)
+{
+	return (unsigned*)((uint8_t*)brick - BRICK_HEAD);
+}
+
+/* a zeroed brick of sz bytes, referenced once */
+static uint16_t *BrickNew(size_t sz)
+{
+	uint8_t *mem = calloc(1, BRICK_HEAD + sz);
+	
+	if (!mem)
+		return 0;
+	
+	*(unsigned*)mem = 1;
+	
+	return (uint16_t*)(mem + BRICK_HEAD);
+}
+
+static void BrickRelease(uint16_t *brick)
+{
+	if (brick && !--*BrickRefs(brick))
+		free((uint8_t*)brick - BRICK_HEAD);
+}
+
+/* default 16-bit -> 8-bit shade mapping (see inv_make_8bit) */
+static inline uint8_t Shade8Default(uint16_t v)
+{
+	// TODO why are these specific values required to match ImageJ's output?
+	float brightness = -0.23;
+	float contrast = 17.500031;
+	float conv = v * (1.0f / 65535.0f);
+	
+	/* simple brightness and contrast
+	 * https://www.gegl.org/brightness-contrast.c.html
+	 */
+	conv -= 0.5f;
+	conv *= contrast;
+	conv += brightness;
+	conv += 0.5f;
+	if (conv < 0)
+		conv = 0;
+	if (conv > 1)
+		conv = 1;
+	
+	/* final 8-bit grayscale shade */
+	conv *= 255;
+	return conv;
+}
+
+/* 16-bit -> 8-bit shade through a window in sample units, or the
+ * default mapping if width <= 0
+ */
+static inline uint8_t Shade8Window(int center, int width, uint16_t v)
+{
+	float conv;
+	
+	if (width <= 0)
+		return Shade8Default(v);
+	
+	/* linear ramp across [center - width / 2, center + width / 2] */
+	conv = (v - (center - width * 0.5f)) / width;
+	if (conv < 0)
+		conv = 0;
+	if (conv > 1)
+		conv = 1;
+	
+	return conv * 255;
+}
+
+/* 16-bit -> 8-bit shade mapping used when loading 8-bit volumes */
+static inline uint8_t Shade8(const struct inv *inv, uint16_t v)
+{
+	return Shade8Window(inv->windowCenter, inv->windowWidth, v);
+}
+
 /* loads all raw pixel data from a JPC into a buffer */
-static void jpcLoadPixelsInto(void **dst, void *src, uint32_t sz, void *dstEnd)
+static void jpcLoadPixelsInto(const struct inv *inv, void **dst, void *src, uint32_t sz, void *dstEnd)
 {
 	jas_image_t *image;
 	jas_stream_t *stream;
 	unsigned cmp;
 	int fmt;
-	uint8_t *gray = *dst;
+	uint16_t *gray = *dst;
+	uint8_t *gray8 = *dst;
 	
 	/* open stream */
 	stream = jas_stream_memopen(src, sz);
@@ -90,7 +289,7 @@ static void jpcLoadPixelsInto(void **dst, void *src, uint32_t sz, void *dstEnd)
 		int y;
 		
 		/* exhausted the allocated pixel buffer */
-		if (gray >= (uint8_t*)dstEnd)
+		if ((void*)gray >= dstEnd || (void*)gray8 >= dstEnd)
 		{
 			fprintf(stderr, "error: more images than expected\n");
 			abort();
@@ -104,8 +303,11 @@ static void jpcLoadPixelsInto(void **dst, void *src, uint32_t sz, void *dstEnd)
 				
 				v -= 0x8000;
 				
-				*gray = v; gray++;
-				*gray = v >> 8; gray++;
+				/* 8-bit volumes are converted as they are decoded */
+				if (inv->grayBps == 1)
+					*gray8 = Shade8(inv, v), gray8++;
+				else
+					*gray = v, gray++;
 			}
 		}
 	}
@@ -114,15 +316,20 @@ static void jpcLoadPixelsInto(void **dst, void *src, uint32_t sz, void *dstEnd)
 	jas_stream_close(stream);
 	jas_image_destroy(image);
 	
-	*dst = gray;
+	if (inv->grayBps == 1)
+		*dst = gray8;
+	else
+		*dst = gray;
 }
 
 #ifdef WANT_THREADS
 struct jpcJob
 {
 	jas_thread_t thread;
+	const struct inv *inv;
 	void *outbuf;
 	void *outbufEnd;
+	size_t outbufSz; // bytes this job decodes into
 	void *data;
 	uint32_t sz;
 };
@@ -139,11 +346,18 @@ static int jpcJob(void *handle)
 		return -1;
 	}
 	
+	/* huge page strips are untouched; zero this job's slab from
+	 * this thread, so its pages are placed on this thread's node
+	 */
+	if (job->inv->hasHugePages)
+		memset(job->outbuf, 0, job->outbufSz);
+	
 	/* process image */
-	jpcLoadPixelsInto(&job->outbuf, job->data, job->sz, job->outbufEnd);
+	jpcLoadPixelsInto(job->inv, &job->outbuf, job->data, job->sz, job->outbufEnd);
 	
-	/* this reports progress */
-	fprintf(stdout, "%p\n", job->data);
+	/* this reports progress (streamed loads are not reported) */
+	if (!IsStreamed(job->inv))
+		fprintf(stdout, "%p\n", job->data);
 	
 	/* cleanup thread */
 	jas_cleanup_thread();
@@ -266,6 +480,8 @@ static int jasper_begin(bool isThreaded)
 	return 0;
 }
 
+static int AppendedData_stream(struct inv *inv, uint8_t *data);
+
 static inline int AppendedData_parse(struct inv *inv)
 {
 	uint8_t *data;
@@ -273,6 +489,7 @@ static inline int AppendedData_parse(struct inv *inv)
 	uint8_t *dataJPCblock;
 	uint32_t *grayJPCsz;
 	size_t dataSz = inv->AppendedDataSz;
+	void *strip;
 	unsigned int i;
 	int cmpnoLast;
 	
@@ -350,16 +567,42 @@ static inline int AppendedData_parse(struct inv *inv)
 		}
 	}
 	
-	/* allocate memory for 16-bit image data for each image */
+	/* allocate memory for 16-bit (or 8-bit) image data for each image */
 	inv->grayNum = (inv->grayJPC - (cmpnoLast != 0)) * inv->cmpno + cmpnoLast;
-	inv->graySz = 2 * inv->grayWidth * inv->grayHeight * inv->grayNum;
-	inv->gray = calloc(1, inv->graySz);
-	if (!inv->gray)
+	
+	/* out-of-core volumes never get a strip */
+	if (IsStreamed(inv))
+	{
+		int result;
+		
+		if (jasper_begin(inv->isThreaded))
+		{
+			fprintf(stderr, "libjasper error\n");
+			return 1;
+		}
+		result = AppendedData_stream(inv, dataJPCblock);
+		jasper_cleanup();
+		
+		return result;
+	}
+	
+	inv->graySz = (size_t)2 * inv->grayWidth * inv->grayHeight * inv->grayNum;
+	if (inv->grayBps == 1)
+		inv->graySz /= 2;
+	if (inv->hasHugePages)
+		strip = alloc_huge(inv->graySz, inv->isInterleaved);
+	else
+		strip = calloc(1, inv->graySz);
+	if (inv->grayBps == 1)
+		inv->gray8 = strip;
+	else
+		inv->gray = strip;
+	if (!GetStrip(inv))
 	{
 		fprintf(stderr, "memory error\n");
 		return 1;
 	}
-	inv->grayEnd = ((uint8_t*)inv->gray) + inv->graySz;
+	inv->grayEnd = GetStrip(inv) + inv->graySz;
 	
 	/* initialize libjasper */
 	if (jasper_begin(inv->isThreaded))
@@ -376,10 +619,13 @@ static inline int AppendedData_parse(struct inv *inv)
 	#ifndef WANT_THREADS
 	L_nothreading:
 	#endif
+		if (inv->hasHugePages)
+			memset(GetStrip(inv), 0, inv->graySz);
+		
 		/* parse each image */
-		for (i = 0, dst = inv->gray, data = dataJPCblock; i < inv->grayJPC; data += grayJPCsz[i++])
+		for (i = 0, dst = GetStrip(inv), data = dataJPCblock; i < inv->grayJPC; data += grayJPCsz[i++])
 		{
-			jpcLoadPixelsInto(&dst, data, grayJPCsz[i], inv->grayEnd);
+			jpcLoadPixelsInto(inv, &dst, data, grayJPCsz[i], inv->grayEnd);
 			
 			/* it can be slow, so I tossed this here to report progress */
 			fprintf(stdout, "%p\n", data);
@@ -401,12 +647,16 @@ static inline int AppendedData_parse(struct inv *inv)
 		}
 		
 		/* spin up a thread for each image */
-		for (i = 0, gray = inv->gray, data = dataJPCblock; i < inv->grayJPC; data += grayJPCsz[i++])
+		for (i = 0, gray = GetStrip(inv), data = dataJPCblock; i < inv->grayJPC; data += grayJPCsz[i++])
 		{
 			struct jpcJob *thisjob = &job[i];
 			
-			thisjob->outbuf = gray + inv->grayWidth * inv->grayHeight * 2 * inv->cmpno * i;
+			thisjob->inv = inv;
+			thisjob->outbuf = gray + (size_t)inv->grayWidth * inv->grayHeight * inv->grayBps * inv->cmpno * i;
 			thisjob->outbufEnd = inv->grayEnd;
+			thisjob->outbufSz = (uint8_t*)inv->grayEnd - (uint8_t*)thisjob->outbuf;
+			if (thisjob->outbufSz > (size_t)inv->grayWidth * inv->grayHeight * inv->grayBps * inv->cmpno)
+				thisjob->outbufSz = (size_t)inv->grayWidth * inv->grayHeight * inv->grayBps * inv->cmpno;
 			thisjob->data = data;
 			thisjob->sz = grayJPCsz[i];
 			
@@ -459,8 +709,14 @@ int inv_get_height(struct inv *inv)
 	return inv->grayHeight;
 }
 
+/* returns 1 for volumes loaded in 8-bit mode, 2 otherwise */
+int inv_get_bytes_per_sample(struct inv *inv)
+{
+	return inv->grayBps;
+}
+
 /* allocates and returns a new inv populated with some default values */
-static struct inv *inv_new(void)
+static struct inv *inv_new(const struct inv_opts *opts)
 {
 	struct inv *inv = calloc(1, sizeof(*inv));
 	
@@ -479,6 +735,21 @@ static struct inv *inv_new(void)
 	/* components */
 	inv->cmpno = 7;
 	
+	/* load options */
+	inv->grayBps = 2;
+	if (opts)
+	{
+		inv->isThreaded = opts->isThreaded;
+		inv->hasHugePages = opts->hasHugePages || opts->isInterleaved;
+		inv->isInterleaved = opts->isInterleaved;
+		inv->brickDim = opts->brickDim;
+		inv->residentSz = (size_t)opts->residentLimit << 20;
+		inv->windowCenter = opts->windowCenter;
+		inv->windowWidth = opts->windowWidth;
+		if (opts->is8bit)
+			inv->grayBps = 1;
+	}
+	
 	return inv;
 }
 
@@ -487,14 +758,176 @@ const void *inv_get_frame(struct inv *inv, unsigned image)
 	assert(inv);
 	assert(image < inv->grayNum);
 	
-	return ((uint16_t*)inv->gray) + inv->grayWidth * inv->grayHeight * image;
+	return GetStrip(inv) + (size_t)inv->grayWidth * inv->grayHeight * inv->grayBps * image;
 }
 
 static const uint16_t *GetFrame16(struct inv *inv, unsigned image)
 {
+	assert(inv->gray);
+	
 	return inv_get_frame(inv, image);
 }
 
+const uint16_t *inv_get_frame16(struct inv *inv, int image)
+{
+	assert(image >= 0);
+	
+	return GetFrame16(inv, image);
+}
+
+/* decodes a brick made by PackBrick */
+static void UnpackBrick(const uint64_t *packed, uint16_t *dst, int num)
+{
+	int groups = num / PACK_GROUP;
+	const uint8_t *width = (const uint8_t*)packed;
+	const uint64_t *in = packed + (groups + 7) / 8;
+	uint16_t prev = 0;
+	int g;
+	int i;
+	
+	for (g = 0; g < groups; ++g, dst += PACK_GROUP)
+	{
+		int bits = width[g];
+		uint64_t mask = (1ull << bits) - 1;
+		
+		/* constant run */
+		if (!bits)
+		{
+			for (i = 0; i < PACK_GROUP; ++i)
+				dst[i] = prev;
+			continue;
+		}
+		
+		for (i = 0; i < PACK_GROUP; ++i)
+		{
+			int pos = i * bits;
+			int off = pos & 63;
+			uint64_t v = in[pos >> 6] >> off;
+			uint16_t zz;
+			
+			if (off + bits > 64)
+				v |= in[(pos >> 6) + 1] << (64 - off);
+			zz = v & mask;
+			
+			/* undo zigzag, then the delta */
+			prev += (uint16_t)((zz >> 1) ^ -(zz & 1));
+			dst[i] = prev;
+		}
+		in += bits;
+	}
+}
+
+/* lossless brick codec: every sample is stored as the zigzagged
+ * difference from the previous one, and each group of PACK_GROUP
+ * differences is bit-packed at the width of its largest; the result
+ * is a header of per-group widths (one byte each, padded to 8 bytes)
+ * followed by the packed groups, each one 'width' words long
+ */
+static uint64_t *PackBrick(const uint16_t *src, int num, size_t *sz)
+{
+	int groups = num / PACK_GROUP;
+	int hdr = (groups + 7) / 8;
+	uint64_t *packed = calloc(hdr + (size_t)groups * 16, sizeof(*packed));
+	uint64_t *shrunk;
+	uint64_t *out;
+	uint8_t *width;
+	uint16_t prev = 0;
+	int g;
+	int i;
+	
+	if (!packed)
+		return 0;
+	
+	width = (uint8_t*)packed;
+	out = packed + hdr;
+	for (g = 0; g < groups; ++g, src += PACK_GROUP)
+	{
+		uint16_t zz[PACK_GROUP];
+		unsigned all = 0;
+		int bits = 0;
+		
+		for (i = 0; i < PACK_GROUP; ++i)
+		{
+			uint16_t delta = src[i] - prev;
+			
+			zz[i] = (uint16_t)(delta << 1) ^ ((delta & 0x8000) ? 0xffff : 0);
+			all |= zz[i];
+			prev = src[i];
+		}
+		while (all >> bits)
+			++bits;
+		
+		width[g] = bits;
+		for (i = 0; i < PACK_GROUP && bits; ++i)
+		{
+			int pos = i * bits;
+			int off = pos & 63;
+			
+			out[pos >> 6] |= (uint64_t)zz[i] << off;
+			if (off + bits > 64)
+				out[(pos >> 6) + 1] |= (uint64_t)zz[i] >> (64 - off);
+		}
+		out += bits;
+	}
+	
+	*sz = (out - packed) * sizeof(*packed);
+	if ((shrunk = realloc(packed, *sz)))
+		packed = shrunk;
+	
+	return packed;
+}
+
+static int SeekBrick(struct inv *inv, size_t index);
+
+/* a packed or out-of-core brick, through the cache; the cache is not
+ * thread-safe, but bricked volumes are only read from one thread
+ */
+static uint16_t *GetCachedBrick(struct inv *inv, size_t index)
+{
+	struct invBrickCache *c = &inv->brickCache[index % inv->brickCacheNum];
+	size_t num = (size_t)inv->brickDim * inv->brickDim * inv->brickDim;
+	
+	if (c->index == index)
+		return c->data;
+	
+	if (inv->brickPacked)
+		UnpackBrick(inv->brickPacked[index], c->data, num);
+	else if (SeekBrick(inv, index) || fread(c->data, sizeof(*c->data), num, inv->brickFile) != num)
+	{
+		fprintf(stderr, "failed to read out-of-core brick store\n");
+		abort();
+	}
+	c->index = index;
+	
+	return c->data;
+}
+
+static inline uint16_t *GetBrick(struct inv *inv, int bx, int by, int bz)
+{
+	size_t index = ((size_t)bz * inv->brickY + by) * inv->brickX + bx;
+	
+	if (!inv->brick[index])
+		return GetCachedBrick(inv, index);
+	
+	return inv->brick[index];
+}
+
+static inline const uint8_t *GetRow12(const struct inv *inv, int y, int z)
+{
+	return inv->gray12 + ((size_t)z * inv->grayHeight + y) * inv->gray12RowSz;
+}
+
+/* sample x of a 12-bit packed row; each pair of samples shares 3 bytes,
+ * the first sample in the low 12 bits
+ */
+static inline uint16_t GetSample12(const struct inv *inv, const uint8_t *row, int x)
+{
+	const uint8_t *p = row + (x >> 1) * 3;
+	unsigned v = (x & 1) ? (p[1] >> 4) | (p[2] << 4) : p[0] | ((p[1] & 0x0f) << 8);
+	
+	return (v << inv->gray12Shift) + inv->gray12Base;
+}
+
 static uint16_t GetSample16(struct inv *inv, int x, int y, int z)
 {
 	assert(inv);
@@ -502,97 +935,4083 @@ static uint16_t GetSample16(struct inv *inv, int x, int y, int z)
 	assert(y < (int)inv->grayHeight);
 	assert(z < (int)inv->grayNum);
 	
+	if (inv->parent)
+		return GetSample16(inv->parent, x + inv->viewX, y + inv->viewY, z + inv->viewZ);
+	
+	if (inv->brick)
+	{
+		int s = inv->brickShift;
+		int m = inv->brickDim - 1;
+		
+		return GetBrick(inv, x >> s, y >> s, z >> s)[((((z & m) << s) + (y & m)) << s) + (x & m)];
+	}
+	
+	if (inv->gray12)
+		return GetSample12(inv, GetRow12(inv, y, z), x);
+	
 	return GetFrame16(inv, z)[y * inv->grayWidth + x];
 }
 
-const void *inv_get_plane(struct inv *inv, void *dst, int image, enum inv_plane plane)
+static uint8_t GetSample8(struct inv *inv, int x, int y, int z)
+{
+	assert(inv);
+	assert(x < (int)inv->grayWidth);
+	assert(y < (int)inv->grayHeight);
+	assert(z < (int)inv->grayNum);
+	
+	if (inv->parent)
+		return GetSample8(inv->parent, x + inv->viewX, y + inv->viewY, z + inv->viewZ);
+	
+	return ((const uint8_t*)inv_get_frame(inv, z))[y * inv->grayWidth + x];
+}
+
+uint16_t inv_get_sample16(struct inv *inv, int x, int y, int z)
+{
+	assert(x >= 0 && y >= 0 && z >= 0);
+	
+	return GetSample16(inv, x, y, z);
+}
+
+uint8_t inv_get_sample8(struct inv *inv, int x, int y, int z)
+{
+	assert(x >= 0 && y >= 0 && z >= 0);
+	
+	return GetSample8(inv, x, y, z);
+}
+
+/* planes with at least this many samples are split across threads */
+#define PLANE_PARALLEL_MIN (1 << 17)
+
+struct planeJob
+{
+	struct inv *inv;
+	uint8_t *dst;
+	int image;
+	enum inv_plane plane;
+};
+
+/* slice-major reslice kernel; writes output rows [begin, end) */
+static void PlaneRows(void *udata, int begin, int end)
 {
-	const uint16_t *gray = inv->gray;
-	uint16_t *dstv = dst;
+	const struct planeJob *job = udata;
+	struct inv *inv = job->inv;
+	int bps = inv->grayBps;
 	int w = inv->grayWidth;
 	int h = inv->grayHeight;
 	int d = inv->grayNum;
-	int x;
-	int y;
-	int z;
+	int image = job->image;
+	int r;
 	
-	assert(image >= 0);
+	switch (job->plane)
+	{
+		case INV_PLANE_AXIAL: // output rows are rows of the frame
+			memcpy(job->dst + (size_t)begin * w * bps
+				, ((const uint8_t*)inv_get_frame(inv, image)) + (size_t)begin * w * bps
+				, (size_t)(end - begin) * w * bps
+			);
+			break;
+		
+		case INV_PLANE_SAGITTAL: // output row r = column 'image' of frame d - r - 1, bottom to top
+			for (r = begin; r < end; ++r)
+			{
+				int c;
+				
+				if (bps == 1)
+				{
+					const uint8_t *src = ((const uint8_t*)inv_get_frame(inv, d - r - 1)) + (h - 1) * w + image;
+					uint8_t *dst = job->dst + (size_t)r * h;
+					
+					for (c = 0; c < h; ++c, src -= w)
+						dst[c] = *src;
+				}
+				else
+				{
+					const uint16_t *src = GetFrame16(inv, d - r - 1) + (h - 1) * w + image;
+					uint16_t *dst = ((uint16_t*)job->dst) + (size_t)r * h;
+					
+					for (c = 0; c < h; ++c, src -= w)
+						dst[c] = *src;
+				}
+			}
+			break;
+		
+		case INV_PLANE_CORONAL: // output row r = row 'image' of frame d - r - 1
+			for (r = begin; r < end; ++r)
+				memcpy(job->dst + (size_t)r * w * bps
+					, ((const uint8_t*)inv_get_frame(inv, d - r - 1)) + (size_t)image * w * bps
+					, (size_t)w * bps
+				);
+			break;
+		
+		default:
+			break;
+	}
+}
+
+/* unpacks n samples of a 12-bit packed row; SSE2 does 8 at a time,
+ * from two overlapping 8-byte loads (Pack12 pads the end of the data)
+ */
+static void Unpack12(const struct inv *inv, uint16_t *dst, const uint8_t *src, int n)
+{
+	int x = 0;
 	
-	memset(dst, 0, w * h * sizeof(*gray));
+#ifdef __SSE2__
+	__m128i base = _mm_set1_epi16(inv->gray12Base);
+	__m128i shift = _mm_cvtsi32_si128(inv->gray12Shift);
+	__m128i m0 = _mm_set1_epi64x(0x0fff);
+	__m128i m1 = _mm_slli_epi64(m0, 16);
+	__m128i m2 = _mm_slli_epi64(m0, 32);
+	__m128i m3 = _mm_slli_epi64(m0, 48);
 	
-	switch (plane)
+	for (; x + 8 <= n; x += 8, src += 12)
+	{
+		/* samples 0-3 at bits 0, 12, 24, 36 of the low half, samples
+		 * 4-7 likewise in the high half; each moves 4 bits per sample
+		 * up, into its own 16-bit lane
+		 */
+		__m128i q = _mm_unpacklo_epi64(
+			_mm_loadl_epi64((const __m128i*)src)
+			, _mm_loadl_epi64((const __m128i*)(src + 6))
+		);
+		__m128i v = _mm_or_si128(
+			_mm_or_si128(_mm_and_si128(q, m0), _mm_and_si128(_mm_slli_epi64(q, 4), m1))
+			, _mm_or_si128(_mm_and_si128(_mm_slli_epi64(q, 8), m2), _mm_and_si128(_mm_slli_epi64(q, 12), m3))
+		);
+		
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_add_epi16(_mm_sll_epi16(v, shift), base));
+	}
+#endif
+	
+	for (; x + 2 <= n; x += 2, src += 3)
+	{
+		dst[x] = ((src[0] | ((src[1] & 0x0f) << 8)) << inv->gray12Shift) + inv->gray12Base;
+		dst[x + 1] = (((src[1] >> 4) | (src[2] << 4)) << inv->gray12Shift) + inv->gray12Base;
+	}
+	
+	if (x < n)
+		dst[x] = ((src[0] | ((src[1] & 0x0f) << 8)) << inv->gray12Shift) + inv->gray12Base;
+}
+
+/* PlaneRows for 12-bit packed volumes */
+static void PlaneRows12(void *udata, int begin, int end)
+{
+	const struct planeJob *job = udata;
+	struct inv *inv = job->inv;
+	uint16_t *dst = (uint16_t*)job->dst;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int d = inv->grayNum;
+	int image = job->image;
+	int r;
+	
+	switch (job->plane)
 	{
 		case INV_PLANE_AXIAL:
-			if (image >= d)
-				break;
-			//image %= d;
-			for (y = 0; y < h; ++y)
-				for (x = 0; x < w; ++x, ++dstv)
-					*dstv = GetSample16(inv, x, y, image);
-			//if (image < d)
-			//	memcpy(dst, inv_get_frame(inv, image), w * h * sizeof(*gray));
+			for (r = begin; r < end; ++r)
+				Unpack12(inv, dst + (size_t)r * w, GetRow12(inv, r, image), w);
 			break;
 		
-		case INV_PLANE_SAGITTAL:
-			if (image >= w)
-				break;
-			//image %= w;
-			dstv += d * h - 1;
-			for (z = 0; z < d; ++z)
-				for (y = 0; y < h; ++y, --dstv)
-					*dstv = GetSample16(inv, image, y, z);
+		case INV_PLANE_SAGITTAL: // one sample per row, bottom to top
+			for (r = begin; r < end; ++r)
+			{
+				const uint8_t *src = GetRow12(inv, h - 1, d - r - 1) + (image >> 1) * 3;
+				uint16_t *out = dst + (size_t)r * h;
+				size_t stride = inv->gray12RowSz;
+				int base = inv->gray12Base;
+				int shift = inv->gray12Shift;
+				int c;
+				
+				if (image & 1)
+					for (c = 0; c < h; ++c, src -= stride)
+						out[c] = (((src[1] >> 4) | (src[2] << 4)) << shift) + base;
+				else
+					for (c = 0; c < h; ++c, src -= stride)
+						out[c] = ((src[0] | ((src[1] & 0x0f) << 8)) << shift) + base;
+			}
 			break;
 		
 		case INV_PLANE_CORONAL:
-			if (image >= h)
-				break;
-			//image %= h;
-			for (z = 0; z < d; ++z)
-				for (x = 0; x < w; ++x, ++dstv)
-					*dstv = GetSample16(inv, x, image, d - z - 1);
+			for (r = begin; r < end; ++r)
+				Unpack12(inv, dst + (size_t)r * w, GetRow12(inv, image, d - r - 1), w);
 			break;
 		
 		default:
 			break;
 	}
-	
-	return dst;
 }
 
-void inv_free(struct inv *inv)
+/* inv_get_plane for bricked volumes; walks the bricks intersecting
+ * the plane, so rows are read contiguously within each brick
+ */
+static const void *GetPlaneBricked(struct inv *inv, uint16_t *dst, int image, enum inv_plane plane)
 {
-	if (!inv)
-		return;
-	
-	if (inv->data)
-		free(inv->data);
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int d = inv->grayNum;
+	int B = inv->brickDim;
+	int s = inv->brickShift;
+	int m = B - 1;
+	int bx;
+	int by;
+	int bz;
 	
-	if (inv->AppendedData)
-		free(inv->AppendedData);
+	switch (plane)
+	{
+		case INV_PLANE_AXIAL:
+			if (image >= d)
+				break;
+			bz = image >> s;
+			for (by = 0; by < inv->brickY; ++by)
+			{
+				for (bx = 0; bx < inv->brickX; ++bx)
+				{
+					const uint16_t *src = GetBrick(inv, bx, by, bz) + ((image & m) << (s * 2));
+					int x0 = bx << s;
+					int y0 = by << s;
+					int nx = w - x0 < B ? w - x0 : B;
+					int ny = h - y0 < B ? h - y0 : B;
+					int yy;
+					
+					for (yy = 0; yy < ny; ++yy, src += B)
+						memcpy(dst + (y0 + yy) * w + x0, src, nx * sizeof(*dst));
+				}
+			}
+			break;
+		
+		case INV_PLANE_SAGITTAL:
+			if (image >= w)
+				break;
+			bx = image >> s;
+			for (bz = 0; bz < inv->brickZ; ++bz)
+			{
+				for (by = 0; by < inv->brickY; ++by)
+				{
+					const uint16_t *src = GetBrick(inv, bx, by, bz) + (image & m);
+					int y0 = by << s;
+					int z0 = bz << s;
+					int ny = h - y0 < B ? h - y0 : B;
+					int nz = d - z0 < B ? d - z0 : B;
+					int yy;
+					int zz;
+					
+					/* same orientation as the slice-major path */
+					for (zz = 0; zz < nz; ++zz)
+					{
+						uint16_t *dstv = dst + (d * h - 1) - ((z0 + zz) * h + y0);
+						const uint16_t *row = src + (zz << (s * 2));
+						
+						for (yy = 0; yy < ny; ++yy, row += B)
+							dstv[-yy] = *row;
+					}
+				}
+			}
+			break;
+		
+		case INV_PLANE_CORONAL:
+			if (image >= h)
+				break;
+			by = image >> s;
+			for (bz = 0; bz < inv->brickZ; ++bz)
+			{
+				for (bx = 0; bx < inv->brickX; ++bx)
+				{
+					const uint16_t *src = GetBrick(inv, bx, by, bz) + ((image & m) << s);
+					int x0 = bx << s;
+					int z0 = bz << s;
+					int nx = w - x0 < B ? w - x0 : B;
+					int nz = d - z0 < B ? d - z0 : B;
+					int zz;
+					
+					for (zz = 0; zz < nz; ++zz, src += B * B)
+						memcpy(dst + (d - (z0 + zz) - 1) * w + x0, src, nx * sizeof(*dst));
+				}
+			}
+			break;
+		
+		default:
+			break;
+	}
+	
+	return dst;
+}
+
+/* copies an axial slice into the bricks that contain it */
+static void BricksPutSlice(struct inv *inv, const uint16_t *slice, int z)
+{
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int B = inv->brickDim;
+	int s = inv->brickShift;
+	int m = B - 1;
+	int bx;
+	int y;
+	
+	for (y = 0; y < h; ++y, slice += w)
+	{
+		for (bx = 0; bx < inv->brickX; ++bx)
+		{
+			uint16_t *brick = GetBrick(inv, bx, y >> s, z >> s);
+			int x0 = bx << s;
+			int nx = w - x0 < B ? w - x0 : B;
+			
+			memcpy(brick + ((((z & m) << s) + (y & m)) << s), slice + x0, nx * sizeof(*slice));
+		}
+	}
+}
+
+/* brick offsets in the out-of-core store */
+static int SeekBrick(struct inv *inv, size_t index)
+{
+	size_t brickSz = (size_t)inv->brickDim * inv->brickDim * inv->brickDim * sizeof(uint16_t);
+	
+	return fseek64(inv->brickFile, index * brickSz, SEEK_SET);
+}
+
+struct packJob
+{
+	struct inv *inv;
+	size_t first; // index of the layer's first brick
+	size_t *sz; // packed size of each brick in the layer
+	bool isFailed;
+};
+
+/* compresses bricks [first + begin, first + end), freeing the raw ones */
+static void PackBricks(void *udata, int begin, int end)
+{
+	struct packJob *job = udata;
+	struct inv *inv = job->inv;
+	int num = inv->brickDim * inv->brickDim * inv->brickDim;
+	int i;
+	
+	for (i = begin; i < end; ++i)
+	{
+		size_t index = job->first + i;
+		
+		if (!(inv->brickPacked[index] = PackBrick(inv->brick[index], num, &job->sz[i])))
+		{
+			job->isFailed = true;
+			return;
+		}
+		BrickRelease(inv->brick[index]);
+		inv->brick[index] = 0;
+	}
+}
+
+/* sets up the decompressed-brick cache (or, for out-of-core volumes,
+ * the resident set); a prime number of slots keeps bricks of any one
+ * plane (a constant index stride) from colliding
+ */
+static int MakeBrickCache(struct inv *inv, size_t num, size_t cacheSz)
+{
+	size_t brickSz = (size_t)inv->brickDim * inv->brickDim * inv->brickDim * sizeof(uint16_t);
+	size_t slots = cacheSz / brickSz;
+	size_t i;
+	
+	if (slots >= num)
+		slots = num;
+	else
+	{
+		for (; slots > 2; --slots)
+		{
+			for (i = 2; i * i <= slots && slots % i; ++i)
+				;
+			if (i * i > slots)
+				break;
+		}
+	}
+	if (slots < 1)
+		slots = 1;
+	
+	if (!(inv->brickCache = calloc(slots, sizeof(*inv->brickCache))))
+		return 1;
+	inv->brickCacheNum = slots;
+	for (i = 0; i < slots; ++i)
+	{
+		inv->brickCache[i].index = SIZE_MAX;
+		if (!(inv->brickCache[i].data = malloc(brickSz)))
+			return 1;
+	}
+	
+	return 0;
+}
+
+/* starts converting a 16-bit volume to the bricked layout; slices are
+ * then pushed in order with BricksPush, and each layer of bricks is
+ * compressed or written out to the disk store (when residentSz != 0)
+ * as soon as it is complete, so the raw bricked volume never exists
+ * in full; the volume's dimensions must already be known
+ */
+static int BricksBegin(struct inv *inv, int brickDim, bool isCompressed, size_t residentSz)
+{
+	size_t num;
+	int s;
+	
+	assert(inv);
+	assert(!inv->brick);
+	
+	for (s = 0; (1 << s) < brickDim; ++s)
+		;
+	if ((1 << s) != brickDim || brickDim < 4 || brickDim > 256)
+	{
+		fprintf(stderr, "brick size %d is not a power of two in [4,256]\n", brickDim);
+		return 1;
+	}
+	if (isCompressed && residentSz)
+	{
+		fprintf(stderr, "warning: out-of-core bricks are stored uncompressed\n");
+		isCompressed = false;
+	}
+	
+	inv->brickDim = brickDim;
+	inv->brickShift = s;
+	inv->brickX = (inv->grayWidth + brickDim - 1) >> s;
+	inv->brickY = (inv->grayHeight + brickDim - 1) >> s;
+	inv->brickZ = (inv->grayNum + brickDim - 1) >> s;
+	num = (size_t)inv->brickX * inv->brickY * inv->brickZ;
+	inv->brickStoreSz = 0;
+	
+	if (!(inv->brick = calloc(num, sizeof(*inv->brick))))
+		goto L_fail;
+	if (isCompressed
+		&& (!(inv->brickPacked = calloc(num, sizeof(*inv->brickPacked)))
+			|| MakeBrickCache(inv, num, BRICK_CACHE_SZ)
+		)
+	)
+		goto L_fail;
+	if (residentSz)
+	{
+		if (!(inv->brickFile = tmpfile()))
+		{
+			fprintf(stderr, "failed to create out-of-core brick store\n");
+			return 1;
+		}
+		if (MakeBrickCache(inv, num, residentSz))
+			goto L_fail;
+	}
+	
+	return 0;
+	
+L_fail:
+	fprintf(stderr, "memory error\n");
+	return 1;
+}
+
+/* compresses or stores a completed layer of bricks, freeing them */
+static int BricksFlushLayer(struct inv *inv, int bz)
+{
+	size_t layer = (size_t)inv->brickX * inv->brickY;
+	size_t brickSz = (size_t)inv->brickDim * inv->brickDim * inv->brickDim * sizeof(uint16_t);
+	size_t i;
+	
+	if (inv->brickPacked)
+	{
+		struct packJob job = { inv, bz * layer, 0, false };
+		
+		if (!(job.sz = calloc(layer, sizeof(*job.sz))))
+		{
+			fprintf(stderr, "memory error\n");
+			return 1;
+		}
+		thread_for(inv->isThreaded, layer, PackBricks, &job);
+		for (i = 0; i < layer; ++i)
+			inv->brickStoreSz += job.sz[i];
+		free(job.sz);
+		if (job.isFailed)
+		{
+			fprintf(stderr, "memory error\n");
+			return 1;
+		}
+	}
+	else if (inv->brickFile)
+	{
+		/* a layer's bricks are contiguous in the store */
+		if (SeekBrick(inv, bz * layer))
+			goto L_writefail;
+		for (i = bz * layer; i < (bz + 1) * layer; ++i)
+		{
+			if (fwrite(inv->brick[i], 1, brickSz, inv->brickFile) != brickSz)
+				goto L_writefail;
+			BrickRelease(inv->brick[i]);
+			inv->brick[i] = 0;
+			inv->brickStoreSz += brickSz;
+		}
+	}
+	
+	return 0;
+	
+L_writefail:
+	fprintf(stderr, "failed to write out-of-core brick store\n");
+	return 1;
+}
+
+/* copies the next axial slice into the bricks */
+static int BricksPush(struct inv *inv, const uint16_t *slice, int z)
+{
+	size_t layer = (size_t)inv->brickX * inv->brickY;
+	size_t brickSz = (size_t)inv->brickDim * inv->brickDim * inv->brickDim * sizeof(uint16_t);
+	int m = inv->brickDim - 1;
+	size_t i;
+	
+	/* bricks along the edges are zero-padded */
+	if (!(z & m))
+	{
+		for (i = 0; i < layer; ++i)
+		{
+			if (!(inv->brick[(z >> inv->brickShift) * layer + i] = BrickNew(brickSz)))
+			{
+				fprintf(stderr, "memory error\n");
+				return 1;
+			}
+		}
+	}
+	
+	BricksPutSlice(inv, slice, z);
+	
+	/* layer is complete */
+	if ((z & m) == m || z == (int)inv->grayNum - 1)
+		return BricksFlushLayer(inv, z >> inv->brickShift);
+	
+	return 0;
+}
+
+/* finishes BricksBegin; the bricks replace the slice-major strip */
+static void BricksEnd(struct inv *inv, double start)
+{
+	size_t num = (size_t)inv->brickX * inv->brickY * inv->brickZ;
+	size_t brickSz = (size_t)inv->brickDim * inv->brickDim * inv->brickDim * sizeof(uint16_t);
+	double rawSz = (double)num * brickSz;
+	
+	if (inv->gray)
+		free(inv->gray);
+	inv->gray = 0;
+	inv->graySz = num * brickSz;
+	inv->grayEnd = 0;
+	
+	if (inv->brickPacked)
+	{
+		inv->graySz = inv->brickStoreSz;
+		fprintf(stdout, "compressed bricks in %.3f s, %.1f MiB -> %.1f MiB (%.2fx)\n"
+			, timer_now() - start
+			, rawSz / (1 << 20)
+			, (double)inv->brickStoreSz / (1 << 20)
+			, rawSz / inv->brickStoreSz
+		);
+	}
+	else if (inv->brickFile)
+	{
+		fprintf(stdout, "stored bricks out-of-core in %.3f s, %.1f MiB on disk, %.1f MiB resident\n"
+			, timer_now() - start
+			, rawSz / (1 << 20)
+			, (double)inv->brickCacheNum * brickSz / (1 << 20)
+		);
+	}
+}
+
+/* converts a slice-major 16-bit volume to the bricked layout */
+static int Brickify(struct inv *inv, int brickDim, bool isCompressed, size_t residentSz)
+{
+	double start = timer_now();
+	int z;
+	
+	assert(inv);
+	
+	if (!inv->gray)
+	{
+		fprintf(stderr, "warning: bricked layout requires a 16-bit volume; ignoring\n");
+		return 0;
+	}
+	
+	if (BricksBegin(inv, brickDim, isCompressed, residentSz))
+		return 1;
+	
+	for (z = 0; z < (int)inv->grayNum; ++z)
+		if (BricksPush(inv, GetFrame16(inv, z), z))
+			return 1;
+	
+	BricksEnd(inv, start);
+	
+	return 0;
+}
+
+struct pack12Job
+{
+	struct inv *inv;
+	int num; // number of slabs
+	unsigned bits[THREAD_MAX]; // per slab, every (sample - base) or'd together
+};
+
+/* ors together each slab's samples, relative to the base */
+static void Pack12Scan(void *udata, int begin, int end)
+{
+	struct pack12Job *job = udata;
+	struct inv *inv = job->inv;
+	size_t frameSz = (size_t)inv->grayWidth * inv->grayHeight;
+	uint16_t base = inv->gray12Base;
+	int k;
+	
+	for (k = begin; k < end; ++k)
+	{
+		const uint16_t *src = GetFrame16(inv, inv->grayNum * k / job->num);
+		const uint16_t *last = GetFrame16(inv, inv->grayNum * (k + 1) / job->num - 1) + frameSz;
+		uint16_t bits = 0;
+		
+		for (; src < last; ++src)
+			bits |= (uint16_t)(*src - base);
+		
+		job->bits[k] = bits;
+	}
+}
+
+/* packs frames [begin, end) */
+static void Pack12Frames(void *udata, int begin, int end)
+{
+	struct pack12Job *job = udata;
+	struct inv *inv = job->inv;
+	int w = inv->grayWidth;
+	int base = inv->gray12Base;
+	int shift = inv->gray12Shift;
+	int y;
+	int z;
+	
+	for (z = begin; z < end; ++z)
+	{
+		for (y = 0; y < inv->grayHeight; ++y)
+		{
+			const uint16_t *src = GetFrame16(inv, z) + (size_t)y * w;
+			uint8_t *dst = inv->gray12 + ((size_t)z * inv->grayHeight + y) * inv->gray12RowSz;
+			int x;
+			
+			for (x = 0; x < w; x += 2, dst += 3)
+			{
+				unsigned a = (src[x] - base) >> shift;
+				unsigned b = x + 1 < w ? (src[x + 1] - base) >> shift : 0;
+				
+				dst[0] = a;
+				dst[1] = (a >> 8) | (b << 4);
+				dst[2] = b >> 4;
+			}
+		}
+	}
+}
+
+/* converts a slice-major 16-bit volume to 12 bits per sample, if its
+ * samples allow it losslessly: those stored by 12-bit detectors either
+ * span at most 4096 consecutive values, or are 12-bit values scaled up
+ * (their low bits are always zero); samples are stored relative to the
+ * lowest one, shifted down by the number of bits that never vary
+ */
+static int Pack12(struct inv *inv)
+{
+	struct pack12Job job = {0};
+	size_t sz;
+	double start = timer_now();
+	double oldSz = inv->graySz;
+	unsigned bits = 0;
+	int lo = UINT16_MAX;
+	int hi = 0;
+	int depth;
+	int k;
+	
+	if (!inv->gray)
+	{
+		fprintf(stderr, "warning: 12-bit storage requires a slice-major 16-bit volume; ignoring\n");
+		return 0;
+	}
+	
+	/* the summary already knows the range */
+	for (k = 0; k < inv->rangeX * inv->rangeY * inv->rangeZ; ++k)
+	{
+		if (inv->range[k].min < lo) lo = inv->range[k].min;
+		if (inv->range[k].max > hi) hi = inv->range[k].max;
+	}
+	
+	job.inv = inv;
+	job.num = inv->isThreaded ? thread_count() : 1;
+	if (job.num > (int)inv->grayNum)
+		job.num = inv->grayNum;
+	inv->gray12Base = lo;
+	thread_for(inv->isThreaded, job.num, Pack12Scan, &job);
+	for (k = 0; k < job.num; ++k)
+		bits |= job.bits[k];
+	
+	/* bits that vary between samples */
+	inv->gray12Shift = 0;
+	while (bits && !(bits & (1u << inv->gray12Shift)))
+		inv->gray12Shift += 1;
+	for (depth = 0; (unsigned)(hi - lo) >> inv->gray12Shift >> depth; ++depth)
+		;
+	
+	if (depth > 12)
+	{
+		fprintf(stdout, "samples have %d significant bits; keeping 16-bit storage\n", depth);
+		inv->gray12Base = inv->gray12Shift = 0;
+		return 0;
+	}
+	
+	/* 16 bytes of slack for Unpack12's loads */
+	inv->gray12RowSz = (size_t)(inv->grayWidth + 1) / 2 * 3;
+	sz = inv->gray12RowSz * inv->grayHeight * inv->grayNum;
+	if (!(inv->gray12 = calloc(1, sz + 16)))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	thread_for(inv->isThreaded, inv->grayNum, Pack12Frames, &job);
+	
+	free(inv->gray);
+	inv->gray = 0;
+	inv->graySz = sz;
+	inv->grayEnd = 0;
+	
+	fprintf(stdout, "packed samples to 12 bits in %.3f s (%d significant bits from %d, step %d), %.1f MiB -> %.1f MiB\n"
+		, timer_now() - start, depth, lo, 1 << inv->gray12Shift
+		, oldSz / (1 << 20), (double)sz / (1 << 20)
+	);
+	
+	return 0;
+}
+
+static inline struct invRange *GetRange(const struct inv *inv, int bx, int by, int bz);
+
+/* a copy of a bricked volume that shares every brick with it; either
+ * one copies a brick only when it first changes it (see inv_edit_brick),
+ * so each variant costs only the bricks it modified; both must still be
+ * released with inv_free, in any order
+ */
+struct inv *inv_snapshot(struct inv *inv)
+{
+	struct inv *snap;
+	size_t num;
+	size_t i;
+	
+	assert(inv);
+	
+	if (!inv->brick || inv->brickPacked || inv->brickFile)
+	{
+		fprintf(stderr, "snapshots require a bricked, uncompressed, in-memory volume\n");
+		return 0;
+	}
+	
+	if (!(snap = inv_new(0)))
+		return 0;
+	
+	num = (size_t)inv->brickX * inv->brickY * inv->brickZ;
+	if (!(snap->brick = malloc(num * sizeof(*snap->brick)))
+		|| (inv->range && !(snap->range = malloc((size_t)inv->rangeX * inv->rangeY * inv->rangeZ * sizeof(*snap->range))))
+	)
+	{
+		fprintf(stderr, "memory error\n");
+		inv_free(snap);
+		return 0;
+	}
+	
+	for (i = 0; i < num; ++i)
+	{
+		snap->brick[i] = inv->brick[i];
+		*BrickRefs(snap->brick[i]) += 1;
+	}
+	if (inv->range)
+		memcpy(snap->range, inv->range, (size_t)inv->rangeX * inv->rangeY * inv->rangeZ * sizeof(*snap->range));
+	
+	snap->brickDim = inv->brickDim;
+	snap->brickShift = inv->brickShift;
+	snap->brickX = inv->brickX;
+	snap->brickY = inv->brickY;
+	snap->brickZ = inv->brickZ;
+	snap->rangeX = inv->rangeX;
+	snap->rangeY = inv->rangeY;
+	snap->rangeZ = inv->rangeZ;
+	snap->graySz = inv->graySz;
+	snap->grayNum = inv->grayNum;
+	snap->grayWidth = inv->grayWidth;
+	snap->grayHeight = inv->grayHeight;
+	snap->grayBps = inv->grayBps;
+	snap->isThreaded = inv->isThreaded;
+	snap->windowCenter = inv->windowCenter;
+	snap->windowWidth = inv->windowWidth;
+	strcpy(snap->PatientName, inv->PatientName);
+	strcpy(snap->PatientBirthday, inv->PatientBirthday);
+	strcpy(snap->Watermark, inv->Watermark);
+	strcpy(snap->ImageDate, inv->ImageDate);
+	
+	return snap;
+}
+
+/* brick edge length and the number of bricks along each axis
+ * (all 0 for volumes that aren't bricked)
+ */
+void inv_get_brick_grid(struct inv *inv, int *dim, int *nx, int *ny, int *nz)
+{
+	bool isBricked;
+	
+	assert(inv);
+	
+	isBricked = inv->brick != 0;
+	if (dim) *dim = isBricked ? inv->brickDim : 0;
+	if (nx) *nx = isBricked ? inv->brickX : 0;
+	if (ny) *ny = isBricked ? inv->brickY : 0;
+	if (nz) *nz = isBricked ? inv->brickZ : 0;
+}
+
+/* returns true if samples can be read from many threads at once; the
+ * brick cache of compressed and out-of-core volumes (and views of them)
+ * is not thread-safe (see GetCachedBrick)
+ */
+bool inv_is_thread_safe(struct inv *inv)
+{
+	assert(inv);
+	
+	return !(inv->parent ? inv->parent : inv)->brickCache;
+}
+
+/* returns brick (bx, by, bz) for writing, copying it first if another
+ * snapshot shares it; samples are laid out as in GetSample16; the min/max
+ * summary is left as it was, so call inv_update_ranges afterwards;
+ * returns 0 for volumes inv_snapshot doesn't support
+ */
+uint16_t *inv_edit_brick(struct inv *inv, int bx, int by, int bz)
+{
+	size_t brickSz;
+	size_t index;
+	uint16_t *brick;
+	int p;
+	
+	assert(inv);
+	
+	if (!inv->brick || inv->brickPacked || inv->brickFile)
+		return 0;
+	
+	assert(bx >= 0 && bx < inv->brickX);
+	assert(by >= 0 && by < inv->brickY);
+	assert(bz >= 0 && bz < inv->brickZ);
+	
+	/* copies made before bricking would go stale */
+	for (p = 0; p < INV_PLANE_NUM; ++p)
+	{
+		free(inv->grayPlane[p]);
+		inv->grayPlane[p] = 0;
+	}
+	for (p = 0; p < INV_LEVEL_NUM; ++p)
+	{
+		inv_free(inv->level[p]);
+		inv->level[p] = 0;
+	}
+	free(inv->sums);
+	free(inv->index);
+	free(inv->indexStart);
+	inv->sums = 0;
+	inv->index = 0;
+	inv->indexStart = 0;
+	for (p = 0; p < INV_PLANE_NUM; ++p)
+		inv->slab[p].lo = inv->slab[p].hi = 0;
+	
+	index = ((size_t)bz * inv->brickY + by) * inv->brickX + bx;
+	brick = inv->brick[index];
+	if (*BrickRefs(brick) == 1)
+		return brick;
+	
+	brickSz = (size_t)inv->brickDim * inv->brickDim * inv->brickDim * sizeof(*brick);
+	if (!(inv->brick[index] = BrickNew(brickSz)))
+	{
+		fprintf(stderr, "memory error\n");
+		inv->brick[index] = brick;
+		return 0;
+	}
+	memcpy(inv->brick[index], brick, brickSz);
+	BrickRelease(brick);
+	
+	return inv->brick[index];
+}
+
+/* writes one sample of a bricked volume (see inv_edit_brick); the
+ * summary block holding it is widened to include the new value
+ */
+int inv_set_sample16(struct inv *inv, int x, int y, int z, uint16_t v)
+{
+	int s;
+	int m;
+	uint16_t *brick;
+	
+	assert(inv);
+	assert(x >= 0 && x < inv->grayWidth);
+	assert(y >= 0 && y < inv->grayHeight);
+	assert(z >= 0 && z < (int)inv->grayNum);
+	
+	s = inv->brickShift;
+	m = inv->brickDim - 1;
+	if (!(brick = inv_edit_brick(inv, x >> s, y >> s, z >> s)))
+		return 1;
+	
+	brick[((((z & m) << s) + (y & m)) << s) + (x & m)] = v;
+	
+	if (inv->range)
+	{
+		struct invRange *r = GetRange(inv, x >> RANGE_SHIFT, y >> RANGE_SHIFT, z >> RANGE_SHIFT);
+		
+		if (v < r->min) r->min = v;
+		if (v > r->max) r->max = v;
+	}
+	
+	return 0;
+}
+
+/* transposes tiles of this many samples along each edge */
+#define TRANSPOSE_TILE 64
+
+/* builds the sagittal-major and coronal-major copies for frames [begin, end) */
+static void BuildPlaneCopies(void *udata, int begin, int end)
+{
+	struct inv *inv = udata;
+	size_t bps = inv->grayBps;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int d = inv->grayNum;
+	int z;
+	
+	for (z = begin; z < end; ++z)
+	{
+		const uint8_t *frame = inv_get_frame(inv, z);
+		int r = d - z - 1; // output row for this frame
+		int x0;
+		int y0;
+		int y;
+		
+		/* coronal: row y of this frame is row r of coronal image y */
+		for (y = 0; y < h; ++y)
+			memcpy(inv->grayPlane[INV_PLANE_CORONAL] + (((size_t)y * d + r) * w) * bps
+				, frame + (size_t)y * w * bps
+				, w * bps
+			);
+		
+		/* sagittal: column x of this frame, bottom to top, is row r of
+		 * sagittal image x; transposed one tile at a time so that both
+		 * the reads and the writes stay within a few cache lines
+		 */
+		for (y0 = 0; y0 < h; y0 += TRANSPOSE_TILE)
+		{
+			int y1 = y0 + TRANSPOSE_TILE < h ? y0 + TRANSPOSE_TILE : h;
+			
+			for (x0 = 0; x0 < w; x0 += TRANSPOSE_TILE)
+			{
+				int x1 = x0 + TRANSPOSE_TILE < w ? x0 + TRANSPOSE_TILE : w;
+				int x;
+				
+				for (x = x0; x < x1; ++x)
+				{
+					size_t row = ((size_t)x * d + r) * h + (h - 1);
+					
+					if (bps == 1)
+					{
+						uint8_t *dst = inv->grayPlane[INV_PLANE_SAGITTAL] + row;
+						
+						for (y = y0; y < y1; ++y)
+							dst[-y] = frame[(size_t)y * w + x];
+					}
+					else
+					{
+						uint16_t *dst = ((uint16_t*)inv->grayPlane[INV_PLANE_SAGITTAL]) + row;
+						const uint16_t *src = (const uint16_t*)frame;
+						
+						for (y = y0; y < y1; ++y)
+							dst[-y] = src[(size_t)y * w + x];
+					}
+				}
+			}
+		}
+	}
+}
+
+/* keeps a sagittal-major and a coronal-major copy of the volume alongside
+ * the axial-major one, so that every plane is a single contiguous block
+ */
+static int MakePlaneCopies(struct inv *inv)
+{
+	size_t sz = inv->graySz;
+	double start = timer_now();
+	
+	assert(GetStrip(inv));
+	
+	if (!(inv->grayPlane[INV_PLANE_SAGITTAL] = malloc(sz))
+		|| !(inv->grayPlane[INV_PLANE_CORONAL] = malloc(sz))
+	)
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	thread_for(inv->isThreaded, inv->grayNum, BuildPlaneCopies, inv);
+	
+	fprintf(stdout, "built sagittal/coronal copies in %.3f s, +%.1f MiB\n"
+		, timer_now() - start, (2.0 * sz) / (1 << 20)
+	);
+	
+	return 0;
+}
+
+/* returns a pointer to plane 'image' if it is stored contiguously
+ * in the format inv_get_plane would produce, or 0 if it is not
+ */
+const void *inv_get_plane_ptr(struct inv *inv, int image, enum inv_plane plane)
+{
+	int num[INV_PLANE_NUM] = { inv->grayNum, inv->grayWidth, inv->grayHeight };
+	int w;
+	int h;
+	
+	assert(inv);
+	assert(plane >= 0 && plane < INV_PLANE_NUM);
+	
+	if (image < 0 || image >= num[plane])
+		return 0;
+	
+	if (plane == INV_PLANE_AXIAL)
+		return GetStrip(inv) ? inv_get_frame(inv, image) : 0;
+	
+	if (!inv->grayPlane[plane])
+		return 0;
+	
+	inv_get_plane_dim(inv, plane, &w, &h);
+	
+	return inv->grayPlane[plane] + (size_t)image * w * h * inv->grayBps;
+}
+
+/* box-filters frames [begin, end) of a pyramid level from the level above it */
+static void BuildLevel(void *udata, int begin, int end)
+{
+	struct inv **pair = udata;
+	struct inv *src = pair[0];
+	struct inv *dst = pair[1];
+	int bps = src->grayBps;
+	int sw = src->grayWidth;
+	int sh = src->grayHeight;
+	int sd = src->grayNum;
+	int w = dst->grayWidth;
+	int h = dst->grayHeight;
+	unsigned *sum = malloc(w * 2 * sizeof(*sum));
+	unsigned *cnt = sum + w;
+	int z;
+	
+	if (!sum)
+	{
+		fprintf(stderr, "memory error\n");
+		abort();
+	}
+	
+	for (z = begin; z < end; ++z)
+	{
+		uint8_t *out = ((uint8_t*)inv_get_frame(dst, z));
+		int y;
+		
+		for (y = 0; y < h; ++y)
+		{
+			int dz;
+			int dy;
+			int x;
+			
+			memset(sum, 0, w * 2 * sizeof(*sum));
+			
+			/* accumulate the (up to) 2x2x2 source samples of each output sample */
+			for (dz = 0; dz < 2 && z * 2 + dz < sd; ++dz)
+			{
+				for (dy = 0; dy < 2 && y * 2 + dy < sh; ++dy)
+				{
+					size_t row = (size_t)(y * 2 + dy) * sw;
+					const uint8_t *frame = inv_get_frame(src, z * 2 + dz);
+					
+					for (x = 0; x < w; ++x)
+					{
+						int sx = x * 2;
+						int n = sx + 1 < sw ? 2 : 1;
+						
+						if (bps == 1)
+							sum[x] += frame[row + sx] + (n > 1 ? frame[row + sx + 1] : 0);
+						else
+						{
+							const uint16_t *frame16 = (const uint16_t*)frame;
+							
+							sum[x] += frame16[row + sx] + (n > 1 ? frame16[row + sx + 1] : 0);
+						}
+						cnt[x] += n;
+					}
+				}
+			}
+			
+			/* rounded average */
+			for (x = 0; x < w; ++x)
+			{
+				unsigned v = (sum[x] + cnt[x] / 2) / cnt[x];
+				
+				if (bps == 1)
+					out[(size_t)y * w + x] = v;
+				else
+					((uint16_t*)out)[(size_t)y * w + x] = v;
+			}
+		}
+	}
+	
+	free(sum);
+}
+
+/* builds the mip pyramid, each level box-filtered from the one above it */
+static int MakePyramid(struct inv *inv)
+{
+	struct inv *above = inv;
+	double start = timer_now();
+	size_t total = 0;
+	int i;
+	
+	assert(GetStrip(inv));
+	
+	for (i = 0; i < INV_LEVEL_NUM; ++i)
+	{
+		struct inv *pair[2];
+		struct inv *level;
+		
+		if (!(inv->level[i] = level = inv_new(0)))
+			return 1;
+		level->isThreaded = inv->isThreaded;
+		level->grayBps = inv->grayBps;
+		level->grayWidth = (above->grayWidth + 1) / 2;
+		level->grayHeight = (above->grayHeight + 1) / 2;
+		level->grayNum = (above->grayNum + 1) / 2;
+		level->graySz = (size_t)level->grayWidth * level->grayHeight * level->grayNum * level->grayBps;
+		if (level->grayBps == 1)
+			level->gray8 = malloc(level->graySz);
+		else
+			level->gray = malloc(level->graySz);
+		if (!GetStrip(level))
+		{
+			fprintf(stderr, "memory error\n");
+			return 1;
+		}
+		level->grayEnd = GetStrip(level) + level->graySz;
+		
+		pair[0] = above;
+		pair[1] = level;
+		thread_for(inv->isThreaded, level->grayNum, BuildLevel, pair);
+		
+		total += level->graySz;
+		above = level;
+	}
+	
+	fprintf(stdout, "built %d pyramid levels in %.3f s, +%.1f MiB\n"
+		, INV_LEVEL_NUM, timer_now() - start, (double)total / (1 << 20)
+	);
+	
+	return 0;
+}
+
+static inline struct invSum *GetSum(const struct inv *inv, int x, int y, int z)
+{
+	return &inv->sums[((size_t)z * (inv->grayHeight + 1) + y) * (inv->grayWidth + 1) + x];
+}
+
+/* summed-volume pass 1: running sums along x, for frames [begin, end) */
+static void SumRows(void *udata, int begin, int end)
+{
+	struct inv *inv = udata;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int x;
+	int y;
+	int z;
+	
+	for (z = begin; z < end; ++z)
+	{
+		const uint8_t *frame8 = inv_get_frame(inv, z);
+		const uint16_t *frame16 = (const uint16_t*)frame8;
+		size_t i = 0;
+		
+		for (y = 0; y < h; ++y)
+		{
+			struct invSum *row = GetSum(inv, 0, y + 1, z + 1);
+			
+			for (x = 0; x < w; ++x, ++i)
+			{
+				uint64_t v = inv->grayBps == 1 ? frame8[i] : frame16[i];
+				
+				row[x + 1].sum = row[x].sum + v;
+				row[x + 1].sq = row[x].sq + v * v;
+			}
+		}
+	}
+}
+
+/* summed-volume pass 2: running sums along y, for frames [begin, end) */
+static void SumColumns(void *udata, int begin, int end)
+{
+	struct inv *inv = udata;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int x;
+	int y;
+	int z;
+	
+	for (z = begin; z < end; ++z)
+	{
+		for (y = 1; y < h; ++y)
+		{
+			const struct invSum *above = GetSum(inv, 1, y, z + 1);
+			struct invSum *row = GetSum(inv, 1, y + 1, z + 1);
+			
+			for (x = 0; x < w; ++x)
+			{
+				row[x].sum += above[x].sum;
+				row[x].sq += above[x].sq;
+			}
+		}
+	}
+}
+
+/* summed-volume pass 3: running sums along z, for rows [begin, end) */
+static void SumDepth(void *udata, int begin, int end)
+{
+	struct inv *inv = udata;
+	int w = inv->grayWidth;
+	int d = inv->grayNum;
+	int x;
+	int y;
+	int z;
+	
+	for (y = begin; y < end; ++y)
+	{
+		for (z = 1; z < d; ++z)
+		{
+			const struct invSum *below = GetSum(inv, 1, y + 1, z);
+			struct invSum *row = GetSum(inv, 1, y + 1, z + 1);
+			
+			for (x = 0; x < w; ++x)
+			{
+				row[x].sum += below[x].sum;
+				row[x].sq += below[x].sq;
+			}
+		}
+	}
+}
+
+/* builds the summed-volume table, for constant time box statistics;
+ * it takes 16 bytes per sample, so it's only built on request
+ */
+static int MakeSums(struct inv *inv)
+{
+	size_t sz = (size_t)(inv->grayWidth + 1) * (inv->grayHeight + 1) * (inv->grayNum + 1) * sizeof(*inv->sums);
+	double start = timer_now();
+	
+	assert(GetStrip(inv));
+	
+	/* zeroes along the low edges keep queries branch-free */
+	if (!(inv->sums = calloc(1, sz)))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	thread_for(inv->isThreaded, inv->grayNum, SumRows, inv);
+	thread_for(inv->isThreaded, inv->grayNum, SumColumns, inv);
+	thread_for(inv->isThreaded, inv->grayHeight, SumDepth, inv);
+	
+	fprintf(stdout, "built summed-volume table in %.3f s, +%.1f MiB\n"
+		, timer_now() - start, (double)sz / (1 << 20)
+	);
+	
+	return 0;
+}
+
+/* count, mean, and variance of the samples in the box
+ * [x0, x1) x [y0, y1) x [z0, z1), clipped to the volume, in constant
+ * time; returns non-zero if the volume has no summed-volume table
+ */
+int inv_box_stats(struct inv *inv, int x0, int y0, int z0, int x1, int y1, int z1, size_t *count, double *mean, double *variance)
+{
+	uint64_t sum;
+	uint64_t sq;
+	size_t n;
+	
+	assert(inv);
+	
+	if (!inv->sums)
+		return 1;
+	
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (z0 < 0) z0 = 0;
+	if (x1 > inv->grayWidth) x1 = inv->grayWidth;
+	if (y1 > inv->grayHeight) y1 = inv->grayHeight;
+	if (z1 > (int)inv->grayNum) z1 = inv->grayNum;
+	
+	n = (x0 < x1 && y0 < y1 && z0 < z1) ? (size_t)(x1 - x0) * (y1 - y0) * (z1 - z0) : 0;
+	if (count) *count = n;
+	if (mean) *mean = 0;
+	if (variance) *variance = 0;
+	if (!n)
+		return 0;
+	
+	/* inclusion-exclusion over the box's corners; intermediate
+	 * wraparound cancels out, as the result itself always fits
+	 */
+#define CORNERS(F) \
+	( GetSum(inv, x1, y1, z1)->F - GetSum(inv, x0, y1, z1)->F \
+	- GetSum(inv, x1, y0, z1)->F + GetSum(inv, x0, y0, z1)->F \
+	- GetSum(inv, x1, y1, z0)->F + GetSum(inv, x0, y1, z0)->F \
+	+ GetSum(inv, x1, y0, z0)->F - GetSum(inv, x0, y0, z0)->F )
+	sum = CORNERS(sum);
+	sq = CORNERS(sq);
+#undef CORNERS
+	
+	if (mean)
+		*mean = (double)sum / n;
+	if (variance)
+	{
+		double m = (double)sum / n;
+		double v = (double)sq / n - m * m;
+		
+		*variance = v > 0 ? v : 0;
+	}
+	
+	return 0;
+}
+
+/* like inv_get_plane, but uses the coarsest pyramid level (if any) whose
+ * planes are still at least maxW x maxH samples; 'image' is always in
+ * full resolution coordinates, and the dimensions of the resulting image
+ * are written to w and h
+ */
+const void *inv_get_plane_scaled(struct inv *inv, void *dst, int image, enum inv_plane plane, int maxW, int maxH, int *w, int *h)
+{
+	struct inv *use = inv;
+	int i;
+	
+	assert(inv);
+	assert(w);
+	assert(h);
+	
+	for (i = 0; i < INV_LEVEL_NUM && inv->level[i]; ++i)
+	{
+		int lw;
+		int lh;
+		
+		inv_get_plane_dim(inv->level[i], plane, &lw, &lh);
+		if (lw < maxW || lh < maxH)
+			break;
+		
+		use = inv->level[i];
+		image /= 2;
+	}
+	
+	inv_get_plane_dim(use, plane, w, h);
+	
+	return inv_get_plane(use, dst, image, plane);
+}
+
+/* returns axial slice 'image', copying it into tmp when
+ * the volume isn't stored slice-major
+ */
+static const uint16_t *GetAxial16(struct inv *inv, int image, uint16_t *tmp)
+{
+	if (inv->gray)
+		return GetFrame16(inv, image);
+	
+	return inv_get_plane(inv, tmp, image, INV_PLANE_AXIAL);
+}
+
+/* any sample, as stored (16-bit or 8-bit), from any layout */
+static unsigned GetSample(struct inv *inv, int x, int y, int z)
+{
+	if (inv->grayBps == 1)
+		return GetSample8(inv, x, y, z);
+	
+	return GetSample16(inv, x, y, z);
+}
+
+static inline struct invRange *GetRange(const struct inv *inv, int bx, int by, int bz)
+{
+	return &inv->range[((size_t)bz * inv->rangeY + by) * inv->rangeX + bx];
+}
+
+/* recomputes the min/max summary of the blocks in layer range [begin, end) */
+static void BuildRanges(void *udata, int begin, int end)
+{
+	struct inv *inv = udata;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int d = inv->grayNum;
+	int bz;
+	
+	for (bz = begin; bz < end; ++bz)
+	{
+		int z1 = (bz + 1) * RANGE_DIM < d ? (bz + 1) * RANGE_DIM : d;
+		int bx;
+		int by;
+		int x;
+		int y;
+		int z;
+		
+		for (by = 0; by < inv->rangeY; ++by)
+			for (bx = 0; bx < inv->rangeX; ++bx)
+				*GetRange(inv, bx, by, bz) = (struct invRange){ UINT16_MAX, 0 };
+		
+		for (z = bz * RANGE_DIM; z < z1; ++z)
+		{
+			for (y = 0; y < h; ++y)
+			{
+				struct invRange *row = GetRange(inv, 0, y >> RANGE_SHIFT, bz);
+				
+				/* fast path: straight from the strip */
+				if (GetStrip(inv))
+				{
+					const uint8_t *frame8 = inv_get_frame(inv, z);
+					const uint16_t *frame16 = (const uint16_t*)frame8;
+					size_t i = (size_t)y * w;
+					
+					for (x = 0; x < w; ++x, ++i)
+					{
+						struct invRange *r = row + (x >> RANGE_SHIFT);
+						unsigned v = inv->grayBps == 1 ? frame8[i] : frame16[i];
+						
+						if (v < r->min) r->min = v;
+						if (v > r->max) r->max = v;
+					}
+					continue;
+				}
+				
+				for (x = 0; x < w; ++x)
+				{
+					struct invRange *r = row + (x >> RANGE_SHIFT);
+					unsigned v = GetSample(inv, x, y, z);
+					
+					if (v < r->min) r->min = v;
+					if (v > r->max) r->max = v;
+				}
+			}
+		}
+	}
+}
+
+/* allocates the min/max summary grid */
+static int AllocRanges(struct inv *inv)
+{
+	inv->rangeX = (inv->grayWidth + RANGE_DIM - 1) >> RANGE_SHIFT;
+	inv->rangeY = (inv->grayHeight + RANGE_DIM - 1) >> RANGE_SHIFT;
+	inv->rangeZ = (inv->grayNum + RANGE_DIM - 1) >> RANGE_SHIFT;
+	
+	inv->range = malloc((size_t)inv->rangeX * inv->rangeY * inv->rangeZ * sizeof(*inv->range));
+	if (!inv->range)
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	return 0;
+}
+
+/* builds the min/max summary grid */
+static int MakeRanges(struct inv *inv)
+{
+	if (AllocRanges(inv))
+		return 1;
+	
+	thread_for(inv->isThreaded, inv->rangeZ, BuildRanges, inv);
+	
+	return 0;
+}
+
+/* builds the min/max summary grid one axial slice at a time, in order */
+static void RangesPutSlice(struct inv *inv, const uint16_t *slice, int z)
+{
+	struct invRange *layer = GetRange(inv, 0, 0, z >> RANGE_SHIFT);
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int x;
+	int y;
+	
+	if (!(z & (RANGE_DIM - 1)))
+		for (x = 0; x < inv->rangeX * inv->rangeY; ++x)
+			layer[x] = (struct invRange){ UINT16_MAX, 0 };
+	
+	for (y = 0; y < h; ++y)
+	{
+		struct invRange *row = layer + (y >> RANGE_SHIFT) * inv->rangeX;
+		
+		for (x = 0; x < w; ++x, ++slice)
+		{
+			struct invRange *r = row + (x >> RANGE_SHIFT);
+			
+			if (*slice < r->min) r->min = *slice;
+			if (*slice > r->max) r->max = *slice;
+		}
+	}
+}
+
+/* the min/max summary grid consists of dim^3 blocks, nx * ny * nz of them */
+void inv_get_range_grid(struct inv *inv, int *dim, int *nx, int *ny, int *nz)
+{
+	assert(inv);
+	
+	if (dim) *dim = RANGE_DIM;
+	if (nx) *nx = inv->rangeX;
+	if (ny) *ny = inv->rangeY;
+	if (nz) *nz = inv->rangeZ;
+}
+
+/* min/max sample value within summary block (bx, by, bz) */
+void inv_get_range(struct inv *inv, int bx, int by, int bz, int *min, int *max)
+{
+	const struct invRange *r;
+	
+	assert(inv);
+	assert(inv->range);
+	assert(bx >= 0 && bx < inv->rangeX);
+	assert(by >= 0 && by < inv->rangeY);
+	assert(bz >= 0 && bz < inv->rangeZ);
+	
+	r = GetRange(inv, bx, by, bz);
+	*min = r->min;
+	*max = r->max;
+}
+
+/* returns true if summary block (bx, by, bz) can contain values in [lo, hi] */
+bool inv_range_overlaps(struct inv *inv, int bx, int by, int bz, int lo, int hi)
+{
+	const struct invRange *r = GetRange(inv, bx, by, bz);
+	
+	return r->max >= lo && r->min <= hi;
+}
+
+/* recomputes the summary for every block touching the box
+ * [x0, x1) x [y0, y1) x [z0, z1), e.g. after editing samples
+ */
+void inv_update_ranges(struct inv *inv, int x0, int y0, int z0, int x1, int y1, int z1)
+{
+	int bx;
+	int by;
+	int bz;
+	
+	assert(inv);
+	
+	/* views have no summary */
+	if (!inv->range)
+		return;
+	
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (z0 < 0) z0 = 0;
+	if (x1 > inv->grayWidth) x1 = inv->grayWidth;
+	if (y1 > inv->grayHeight) y1 = inv->grayHeight;
+	if (z1 > (int)inv->grayNum) z1 = inv->grayNum;
+	
+	for (bz = z0 >> RANGE_SHIFT; bz <= (z1 - 1) >> RANGE_SHIFT && z0 < z1; ++bz)
+	{
+		for (by = y0 >> RANGE_SHIFT; by <= (y1 - 1) >> RANGE_SHIFT && y0 < y1; ++by)
+		{
+			for (bx = x0 >> RANGE_SHIFT; bx <= (x1 - 1) >> RANGE_SHIFT && x0 < x1; ++bx)
+			{
+				struct invRange *r = GetRange(inv, bx, by, bz);
+				int xe = (bx + 1) * RANGE_DIM < inv->grayWidth ? (bx + 1) * RANGE_DIM : inv->grayWidth;
+				int ye = (by + 1) * RANGE_DIM < inv->grayHeight ? (by + 1) * RANGE_DIM : inv->grayHeight;
+				int ze = (bz + 1) * RANGE_DIM < (int)inv->grayNum ? (bz + 1) * RANGE_DIM : (int)inv->grayNum;
+				int x;
+				int y;
+				int z;
+				
+				*r = (struct invRange){ UINT16_MAX, 0 };
+				for (z = bz * RANGE_DIM; z < ze; ++z)
+				{
+					for (y = by * RANGE_DIM; y < ye; ++y)
+					{
+						for (x = bx * RANGE_DIM; x < xe; ++x)
+						{
+							unsigned v = GetSample(inv, x, y, z);
+							
+							if (v < r->min) r->min = v;
+							if (v > r->max) r->max = v;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/* flags every summary block that can contain values in [lo, hi], as a
+ * rangeX * rangeY * rangeZ array (release it with free()); returns 0
+ * if there is no summary, or on a memory error, so nothing is skipped
+ */
+static bool *OpenBlocks(struct inv *inv, int lo, int hi)
+{
+	bool *open;
+	bool *b;
+	int bx;
+	int by;
+	int bz;
+	
+	if (!inv->range)
+		return 0;
+	
+	if (!(open = malloc((size_t)inv->rangeX * inv->rangeY * inv->rangeZ * sizeof(*open))))
+	{
+		fprintf(stderr, "memory error\n");
+		return 0;
+	}
+	
+	for (b = open, bz = 0; bz < inv->rangeZ; ++bz)
+		for (by = 0; by < inv->rangeY; ++by)
+			for (bx = 0; bx < inv->rangeX; ++bx)
+				*b++ = inv_range_overlaps(inv, bx, by, bz, lo, hi);
+	
+	return open;
+}
+
+/* returns the open block flags of the summary layer holding slice z,
+ * or 0 if nothing in the layer is open (see OpenBlocks)
+ */
+static const bool *LayerOpen(struct inv *inv, const bool *open, int z)
+{
+	int num = inv->rangeX * inv->rangeY;
+	int i;
+	
+	open += (size_t)(z >> RANGE_SHIFT) * num;
+	for (i = 0; i < num; ++i)
+		if (open[i])
+			return open;
+	
+	return 0;
+}
+
+/* returns true if any block of a row of open block flags touches
+ * the 64 samples starting at x (one mask word, see MaskRow16)
+ */
+static bool WordOpen(struct inv *inv, const bool *row, int x)
+{
+	int bx;
+	
+	for (bx = x >> RANGE_SHIFT; bx < inv->rangeX && bx < (x + 64) >> RANGE_SHIFT; ++bx)
+		if (row[bx])
+			return true;
+	
+	return false;
+}
+
+/* counts the samples with values in [lo, hi]; blocks entirely inside
+ * or outside the range are resolved from the summary alone
+ */
+size_t inv_count_in_range(struct inv *inv, int lo, int hi)
+{
+	size_t count = 0;
+	int bx;
+	int by;
+	int bz;
+	
+	assert(inv);
+	
+	/* views have no summary; count every sample */
+	if (!inv->range)
+	{
+		int x;
+		int y;
+		int z;
+		
+		for (z = 0; z < (int)inv->grayNum; ++z)
+		{
+			for (y = 0; y < inv->grayHeight; ++y)
+			{
+				for (x = 0; x < inv->grayWidth; ++x)
+				{
+					int v = GetSample(inv, x, y, z);
+					
+					count += v >= lo && v <= hi;
+				}
+			}
+		}
+		
+		return count;
+	}
+	
+	for (bz = 0; bz < inv->rangeZ; ++bz)
+	{
+		for (by = 0; by < inv->rangeY; ++by)
+		{
+			for (bx = 0; bx < inv->rangeX; ++bx)
+			{
+				const struct invRange *r = GetRange(inv, bx, by, bz);
+				int xe = (bx + 1) * RANGE_DIM < inv->grayWidth ? (bx + 1) * RANGE_DIM : inv->grayWidth;
+				int ye = (by + 1) * RANGE_DIM < inv->grayHeight ? (by + 1) * RANGE_DIM : inv->grayHeight;
+				int ze = (bz + 1) * RANGE_DIM < (int)inv->grayNum ? (bz + 1) * RANGE_DIM : (int)inv->grayNum;
+				int x;
+				int y;
+				int z;
+				
+				/* nothing in range */
+				if (r->max < lo || r->min > hi)
+					continue;
+				
+				/* everything in range */
+				if (r->min >= lo && r->max <= hi)
+				{
+					count += (size_t)(xe - bx * RANGE_DIM) * (ye - by * RANGE_DIM) * (ze - bz * RANGE_DIM);
+					continue;
+				}
+				
+				for (z = bz * RANGE_DIM; z < ze; ++z)
+				{
+					for (y = by * RANGE_DIM; y < ye; ++y)
+					{
+						for (x = bx * RANGE_DIM; x < xe; ++x)
+						{
+							int v = GetSample(inv, x, y, z);
+							
+							count += v >= lo && v <= hi;
+						}
+					}
+				}
+			}
+		}
+	}
+	
+	return count;
+}
+
+/* inv_auto_window histograms every this many axial slices */
+#define AUTO_WINDOW_STRIDE 4
+
+/* a window (see inv_make_lut) spanning the samples between two
+ * percentiles of the volume's histogram (e.g. 0.5 and 99.5), so that
+ * outliers at either end don't wash out the rest; the histogram covers
+ * every AUTO_WINDOW_STRIDE-th axial slice, inside the field of view
+ * (the zero padding around it is left out); returns non-zero on memory
+ * errors, and for 8-bit volumes (their window was applied on load)
+ */
+int inv_auto_window(struct inv *inv, float low_percent, float high_percent, int *window_center, int *window_width)
+{
+	uint16_t *pix;
+	size_t *histogram;
+	size_t plane = (size_t)inv->grayWidth * inv->grayHeight;
+	size_t total = 0;
+	size_t sum = 0;
+	size_t loCut;
+	size_t hiCut;
+	size_t i;
+	int lo = -1;
+	int hi = -1;
+	int z;
+	
+	assert(inv);
+	assert(window_center);
+	assert(window_width);
+	assert(low_percent >= 0 && low_percent <= high_percent && high_percent <= 100);
+	
+	if (inv->grayBps == 1)
+	{
+		fprintf(stderr, "8-bit volumes can't be rewindowed\n");
+		return 1;
+	}
+	
+	pix = malloc(plane * sizeof(*pix));
+	histogram = calloc(UINT16_MAX + 1, sizeof(*histogram));
+	if (!pix || !histogram)
+	{
+		fprintf(stderr, "memory error\n");
+		free(pix);
+		free(histogram);
+		return 1;
+	}
+	
+	for (z = 0; z < (int)inv->grayNum; z += AUTO_WINDOW_STRIDE)
+	{
+		inv_get_plane(inv, pix, z, INV_PLANE_AXIAL);
+		for (i = 0; i < plane; ++i)
+			histogram[pix[i]] += 1;
+		total += plane;
+	}
+	
+	/* among the samples inside the field of view */
+	total -= histogram[0];
+	histogram[0] = 0;
+	
+	/* the cutoffs, as counts; float would round large totals, so at
+	 * 100 percent no running count might reach its cutoff
+	 */
+	loCut = (size_t)((double)total * low_percent / 100);
+	hiCut = (size_t)((double)total * high_percent / 100);
+	if (hiCut > total)
+		hiCut = total;
+	
+	/* the first values whose running counts pass each percentile
+	 * (at 100 percent, hi is the last non-empty bin)
+	 */
+	for (i = 0; i <= UINT16_MAX && hi < 0; ++i)
+	{
+		sum += histogram[i];
+		if (lo < 0 && sum > loCut)
+			lo = i;
+		if (sum >= hiCut)
+			hi = i;
+	}
+	if (lo < 0)
+		lo = hi;
+	
+	*window_width = hi - lo + 1;
+	*window_center = lo + *window_width / 2;
+	
+	free(pix);
+	free(histogram);
+	
+	return 0;
+}
+
+/* sample values whose default 8-bit shades (see inv_make_8bit) fall in
+ * [minv, maxv], as the interval [lo, hi] in this volume's sample units;
+ * returns non-zero (and an empty interval) if no value qualifies
+ */
+int inv_get_shade_range(struct inv *inv, int minv, int maxv, int *lo, int *hi)
+{
+	int i;
+	
+	assert(inv);
+	assert(lo);
+	assert(hi);
+	
+	if (inv->grayBps == 1)
+	{
+		*lo = minv;
+		*hi = maxv;
+		return minv > maxv;
+	}
+	
+	/* the mapping is monotonic, so the qualifying values are contiguous */
+	*lo = 0x10000;
+	*hi = -1;
+	for (i = 0; i <= UINT16_MAX; ++i)
+	{
+		int v = Shade8Default(i);
+		
+		if (v < minv || v > maxv)
+			continue;
+		if (i < *lo) *lo = i;
+		*hi = i;
+	}
+	
+	return *hi < 0;
+}
+
+/* sets a bit for each sample in [lo, hi] (lo..lo+span), 64 samples
+ * to a word; SSE2 compares 16 at a time, the rest is done bit by bit
+ */
+static void MaskRow16(uint64_t *dst, const uint16_t *src, int w, unsigned lo, unsigned span)
+{
+	int x = 0;
+	
+#ifdef __SSE2__
+	/* SSE2 only compares signed words, so both sides are offset */
+	__m128i vlo = _mm_set1_epi16(lo);
+	__m128i vspan = _mm_set1_epi16(span ^ 0x8000);
+	__m128i vflip = _mm_set1_epi16(INT16_MIN);
+	
+	for (; x + 64 <= w; x += 64)
+	{
+		uint64_t word = 0;
+		int i;
+		
+		for (i = 0; i < 64; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(src + x + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(src + x + i + 8));
+			
+			a = _mm_cmpgt_epi16(_mm_xor_si128(_mm_sub_epi16(a, vlo), vflip), vspan);
+			b = _mm_cmpgt_epi16(_mm_xor_si128(_mm_sub_epi16(b, vlo), vflip), vspan);
+			word |= (uint64_t)(~_mm_movemask_epi8(_mm_packs_epi16(a, b)) & 0xffff) << i;
+		}
+		
+		dst[x >> 6] = word;
+	}
+#endif
+	
+	for (; x < w; x += 64)
+	{
+		int n = w - x < 64 ? w - x : 64;
+		uint64_t word = 0;
+		int i;
+		
+		for (i = 0; i < n; ++i)
+			word |= (uint64_t)((unsigned)src[x + i] - lo <= span) << i;
+		
+		dst[x >> 6] = word;
+	}
+}
+
+static void MaskRow8(uint64_t *dst, const uint8_t *src, int w, unsigned lo, unsigned span)
+{
+	int x = 0;
+	
+#ifdef __SSE2__
+	__m128i vlo = _mm_set1_epi8(lo);
+	__m128i vspan = _mm_set1_epi8(span);
+	
+	for (; x + 64 <= w; x += 64)
+	{
+		uint64_t word = 0;
+		int i;
+		
+		for (i = 0; i < 64; i += 16)
+		{
+			__m128i a = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(src + x + i)), vlo);
+			
+			a = _mm_cmpeq_epi8(_mm_min_epu8(a, vspan), a);
+			word |= (uint64_t)_mm_movemask_epi8(a) << i;
+		}
+		
+		dst[x >> 6] = word;
+	}
+#endif
+	
+	for (; x < w; x += 64)
+	{
+		int n = w - x < 64 ? w - x : 64;
+		uint64_t word = 0;
+		int i;
+		
+		for (i = 0; i < n; ++i)
+			word |= (uint64_t)((unsigned)src[x + i] - lo <= span) << i;
+		
+		dst[x >> 6] = word;
+	}
+}
+
+struct maskJob
+{
+	struct inv *inv;
+	struct inv_mask *mask;
+	void *pix; // slice buffer, when there is no strip to read from
+	bool *open; // summary blocks that can be in range (see OpenBlocks)
+	int lo;
+	int hi;
+};
+
+/* fills the mask's samples [x, x + w) of a row */
+static void MaskRow(struct maskJob *job, uint64_t *dst, const uint8_t *src, int x, int w)
+{
+	if (job->inv->grayBps == 1)
+		MaskRow8(dst + (x >> 6), src + x, w, job->lo, job->hi - job->lo);
+	else
+		MaskRow16(dst + (x >> 6), (const uint16_t*)src + x, w, job->lo, job->hi - job->lo);
+}
+
+/* fills the mask's slices [begin, end) */
+static void MaskSlices(void *udata, int begin, int end)
+{
+	struct maskJob *job = udata;
+	struct inv *inv = job->inv;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int y;
+	int z;
+	
+	for (z = begin; z < end; ++z)
+	{
+		const bool *open = 0;
+		const uint8_t *src;
+		
+		/* the mask starts out empty */
+		if (job->open && !(open = LayerOpen(inv, job->open, z)))
+			continue;
+		
+		if (job->pix)
+			src = inv_get_plane(inv, job->pix, z, INV_PLANE_AXIAL);
+		else
+			src = inv_get_frame(inv, z);
+		
+		for (y = 0; y < h; ++y, src += (size_t)w * inv->grayBps)
+		{
+			uint64_t *dst = inv_mask_get_row(job->mask, y, z);
+			const bool *row;
+			int x;
+			
+			if (!open)
+			{
+				MaskRow(job, dst, src, 0, w);
+				continue;
+			}
+			
+			/* only the runs of words touching an open block */
+			row = open + (y >> RANGE_SHIFT) * inv->rangeX;
+			for (x = 0; x < w; )
+			{
+				int xe;
+				
+				if (!WordOpen(inv, row, x))
+				{
+					x += 64;
+					continue;
+				}
+				
+				for (xe = x + 64; xe < w && WordOpen(inv, row, xe); xe += 64)
+					;
+				if (xe > w)
+					xe = w;
+				
+				MaskRow(job, dst, src, x, xe - x);
+				x = xe;
+			}
+		}
+	}
+}
+
+/* builds a mask of the samples with values in [lo, hi]; release it
+ * with inv_mask_free()
+ */
+struct inv_mask *inv_threshold_mask(struct inv *inv, int lo, int hi)
+{
+	struct maskJob job = {0};
+	
+	assert(inv);
+	
+	if (!(job.mask = inv_mask_new(inv->grayWidth, inv->grayHeight, inv->grayNum)))
+		return 0;
+	
+	/* the kernels compare against a span of sample width, so
+	 * a bound past the largest sample would wrap it around
+	 */
+	if (lo < 0)
+		lo = 0;
+	if (hi > (1 << (8 * inv->grayBps)) - 1)
+		hi = (1 << (8 * inv->grayBps)) - 1;
+	if (lo > hi)
+		return job.mask;
+	
+	job.inv = inv;
+	job.lo = lo;
+	job.hi = hi;
+	job.open = OpenBlocks(inv, lo, hi);
+	
+	/* the strip can be read from many threads; anything else is
+	 * resliced into a buffer, one slice at a time
+	 */
+	if (GetStrip(inv))
+		thread_for(inv->isThreaded, inv->grayNum, MaskSlices, &job);
+	else
+	{
+		if (!(job.pix = malloc((size_t)inv->grayWidth * inv->grayHeight * sizeof(uint16_t))))
+		{
+			fprintf(stderr, "memory error\n");
+			free(job.open);
+			inv_mask_free(job.mask);
+			return 0;
+		}
+		MaskSlices(&job, 0, inv->grayNum);
+		free(job.pix);
+	}
+	
+	free(job.open);
+	
+	return job.mask;
+}
+
+struct indexJob
+{
+	struct inv *inv;
+	int num; // number of slabs
+	size_t *count; // per slab, a count (then a start) for each value
+};
+
+/* counting sort pass 1: histograms the values of each slab */
+static void IndexCount(void *udata, int begin, int end)
+{
+	struct indexJob *job = udata;
+	struct inv *inv = job->inv;
+	size_t frameSz = (size_t)inv->grayWidth * inv->grayHeight;
+	size_t values = (size_t)1 << (inv->grayBps * 8);
+	int k;
+	
+	for (k = begin; k < end; ++k)
+	{
+		size_t *count = job->count + values * k;
+		int z;
+		
+		for (z = inv->grayNum * k / job->num; z < (int)(inv->grayNum * (k + 1) / job->num); ++z)
+		{
+			const uint8_t *frame8 = inv_get_frame(inv, z);
+			const uint16_t *frame16 = (const uint16_t*)frame8;
+			size_t i;
+			
+			if (inv->grayBps == 1)
+				for (i = 0; i < frameSz; ++i)
+					count[frame8[i]] += 1;
+			else
+				for (i = 0; i < frameSz; ++i)
+					count[frame16[i]] += 1;
+		}
+	}
+}
+
+/* counting sort pass 2: places the positions of each slab */
+static void IndexPlace(void *udata, int begin, int end)
+{
+	struct indexJob *job = udata;
+	struct inv *inv = job->inv;
+	size_t frameSz = (size_t)inv->grayWidth * inv->grayHeight;
+	size_t values = (size_t)1 << (inv->grayBps * 8);
+	int k;
+	
+	for (k = begin; k < end; ++k)
+	{
+		size_t *next = job->count + values * k;
+		int z;
+		
+		for (z = inv->grayNum * k / job->num; z < (int)(inv->grayNum * (k + 1) / job->num); ++z)
+		{
+			const uint8_t *frame8 = inv_get_frame(inv, z);
+			const uint16_t *frame16 = (const uint16_t*)frame8;
+			uint32_t pos = frameSz * z;
+			size_t i;
+			
+			if (inv->grayBps == 1)
+				for (i = 0; i < frameSz; ++i)
+					inv->index[next[frame8[i]]++] = pos + i;
+			else
+				for (i = 0; i < frameSz; ++i)
+					inv->index[next[frame16[i]]++] = pos + i;
+		}
+	}
+}
+
+/* sorts every sample position by value (a counting sort, threaded over
+ * slabs of slices), so inv_index_range can list any range of values
+ * without looking at the rest; takes 4 bytes per sample
+ */
+static int MakeIndex(struct inv *inv)
+{
+	struct indexJob job = {0};
+	size_t total = (size_t)inv->grayWidth * inv->grayHeight * inv->grayNum;
+	size_t values = (size_t)1 << (inv->grayBps * 8);
+	size_t start = 0;
+	double began = timer_now();
+	size_t v;
+	int k;
+	
+	assert(GetStrip(inv));
+	
+	if (total > UINT32_MAX)
+	{
+		fprintf(stderr, "warning: volume too large for an intensity index; ignoring\n");
+		return 0;
+	}
+	
+	job.inv = inv;
+	job.num = inv->isThreaded ? thread_count() : 1;
+	if (job.num > (int)inv->grayNum)
+		job.num = inv->grayNum;
+	
+	if (!(inv->index = malloc(total * sizeof(*inv->index)))
+		|| !(inv->indexStart = malloc((values + 1) * sizeof(*inv->indexStart)))
+		|| !(job.count = calloc(values * job.num, sizeof(*job.count)))
+	)
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	thread_for(inv->isThreaded, job.num, IndexCount, &job);
+	
+	/* each slab's run of a value follows the previous slab's */
+	for (v = 0; v < values; ++v)
+	{
+		inv->indexStart[v] = start;
+		for (k = 0; k < job.num; ++k)
+		{
+			size_t count = job.count[values * k + v];
+			
+			job.count[values * k + v] = start;
+			start += count;
+		}
+	}
+	inv->indexStart[values] = start;
+	
+	thread_for(inv->isThreaded, job.num, IndexPlace, &job);
+	free(job.count);
+	
+	fprintf(stdout, "built intensity index in %.3f s, +%.1f MiB\n"
+		, timer_now() - began, (double)total * sizeof(*inv->index) / (1 << 20)
+	);
+	
+	return 0;
+}
+
+/* lists the positions (x + (y + z * h) * w) of the samples with values
+ * in [lo, hi], ordered by value, then by position; returns non-zero if
+ * the volume has no intensity index
+ */
+int inv_index_range(struct inv *inv, int lo, int hi, const uint32_t **pos, size_t *num)
+{
+	int values;
+	
+	assert(inv);
+	assert(pos);
+	assert(num);
+	
+	if (!inv->index)
+		return 1;
+	
+	values = 1 << (inv->grayBps * 8);
+	if (lo < 0)
+		lo = 0;
+	if (hi >= values)
+		hi = values - 1;
+	
+	*pos = inv->index;
+	*num = 0;
+	if (lo > hi)
+		return 0;
+	
+	*pos = inv->index + inv->indexStart[lo];
+	*num = inv->indexStart[hi + 1] - inv->indexStart[lo];
+	
+	return 0;
+}
+
+/* starts streaming a volume whose dimensions are known */
+static int StreamBegin(struct inv *inv)
+{
+	if (AllocRanges(inv))
+		return 1;
+	
+	return BricksBegin(inv, inv->brickDim ? inv->brickDim : 16, false, inv->residentSz);
+}
+
+/* pushes the next axial slice of a streamed volume */
+static int StreamPush(struct inv *inv, const uint16_t *slice, int z)
+{
+	RangesPutSlice(inv, slice, z);
+	
+	return BricksPush(inv, slice, z);
+}
+
+/* decodes an .inv's JPC containers a batch at a time, streaming the
+ * images into the brick store in order (see IsStreamed)
+ */
+static int AppendedData_stream(struct inv *inv, uint8_t *data)
+{
+	double start = timer_now();
+	size_t frameSz = (size_t)inv->grayWidth * inv->grayHeight;
+	int batch = inv->isThreaded ? thread_count() : 1;
+	uint16_t *slab;
+	unsigned i;
+	int z = 0;
+	
+	if (!(slab = malloc(frameSz * inv->cmpno * batch * sizeof(*slab))))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	if (StreamBegin(inv))
+		goto L_fail;
+	
+	for (i = 0; i < inv->grayJPC; i += batch)
+	{
+		uint16_t *slabEnd = slab + frameSz * inv->cmpno * batch;
+		unsigned num = inv->grayJPC - i < (unsigned)batch ? inv->grayJPC - i : (unsigned)batch;
+		unsigned k;
+		
+		memset(slab, 0, frameSz * inv->cmpno * batch * sizeof(*slab));
+		
+	#ifdef WANT_THREADS
+		if (num > 1)
+		{
+			struct jpcJob job[THREAD_MAX];
+			unsigned started;
+			int failed = 0;
+			
+			for (k = 0; k < num; data += inv->grayJPCsz[i + k++])
+			{
+				struct jpcJob *thisjob = &job[k];
+				
+				thisjob->inv = inv;
+				thisjob->outbuf = slab + frameSz * inv->cmpno * k;
+				thisjob->outbufEnd = slabEnd;
+				thisjob->outbufSz = frameSz * inv->cmpno * sizeof(*slab);
+				thisjob->data = data;
+				thisjob->sz = inv->grayJPCsz[i + k];
+				
+				if (jas_thread_create(&thisjob->thread, jpcJob, thisjob))
+				{
+					fprintf(stderr, "jas_thread_create error\n");
+					failed = 1;
+					break;
+				}
+			}
+			
+			/* every thread that started writes into slab, so all
+			 * of them are joined before it can be freed
+			 */
+			started = k;
+			for (k = 0; k < started; ++k)
+			{
+				int result;
+				
+				if (jas_thread_join(&job[k].thread, &result) || result)
+				{
+					fprintf(stderr, "jas_thread_join error on job %u\n", i + k);
+					failed = 1;
+				}
+			}
+			
+			if (failed)
+				goto L_fail;
+		}
+		else
+	#endif
+		{
+			for (k = 0; k < num; data += inv->grayJPCsz[i + k++])
+			{
+				void *dst = slab + frameSz * inv->cmpno * k;
+				
+				jpcLoadPixelsInto(inv, &dst, data, inv->grayJPCsz[i + k], slabEnd);
+			}
+		}
+		
+		/* every container holds cmpno images, except maybe the last */
+		for (k = 0; k < num * inv->cmpno && z < (int)inv->grayNum; ++k, ++z)
+			if (StreamPush(inv, slab + frameSz * k, z))
+				goto L_fail;
+	}
+	
+	free(slab);
+	BricksEnd(inv, start);
+	
+	return 0;
+	
+L_fail:
+	free(slab);
+	return 1;
+}
+
+/* applies layout options after a volume has been loaded */
+static int inv_finish(struct inv *inv, const struct inv_opts *opts)
+{
+	/* always summarized, it's small and cheap
+	 * (streamed volumes are summarized as they load)
+	 */
+	if (!inv->range && MakeRanges(inv))
+		return 1;
+	
+	if (!opts)
+		return 0;
+	
+	if (!GetStrip(inv) && (opts->hasPlaneCopies || opts->hasPyramid || opts->hasSums || opts->hasIndex))
+	{
+		fprintf(stderr, "warning: out-of-core volumes have no plane copies, pyramid, summed-volume table, or intensity index; ignoring\n");
+		return 0;
+	}
+	
+	/* these are made from the slice-major strip, so before bricking */
+	if (opts->hasPlaneCopies && MakePlaneCopies(inv))
+		return 1;
+	if (opts->hasPyramid && MakePyramid(inv))
+		return 1;
+	if (opts->hasSums && MakeSums(inv))
+		return 1;
+	if (opts->hasIndex && MakeIndex(inv))
+		return 1;
+	
+	if (opts->brickDim || opts->isCompressed || opts->residentLimit)
+	{
+		int brickDim = opts->brickDim ? opts->brickDim : 16;
+		
+		/* streamed straight into bricks while loading */
+		if (inv->brick)
+			return 0;
+		
+		if (Brickify(inv, brickDim, opts->isCompressed, (size_t)opts->residentLimit << 20))
+			return 1;
+		
+		if (opts->is12bit)
+			fprintf(stderr, "warning: bricked volumes are not packed to 12 bits; ignoring\n");
+	}
+	else if (opts->is12bit && Pack12(inv))
+		return 1;
+	
+	return 0;
+}
+
+/* inv_get_plane for views; each plane of a view is a rectangle within
+ * the matching plane of its parent, read in place when the parent
+ * stores that plane contiguously, and from a scratch copy otherwise
+ */
+static const void *GetPlaneView(struct inv *inv, uint8_t *dst, int image, enum inv_plane plane)
+{
+	struct inv *parent = inv->parent;
+	const uint8_t *src;
+	int bps = inv->grayBps;
+	int pimage = 0; // parent plane
+	int row = 0; // offset of the view within it
+	int col = 0;
+	int w;
+	int h;
+	int pw;
+	int ph;
+	int r;
+	
+	inv_get_plane_dim(inv, plane, &w, &h);
+	inv_get_plane_dim(parent, plane, &pw, &ph);
+	
+	/* planes run bottom to top and sagittal ones right to left,
+	 * so those offsets are measured from the far side
+	 */
+	switch (plane)
+	{
+		case INV_PLANE_AXIAL:
+			pimage = inv->viewZ + image;
+			row = inv->viewY;
+			col = inv->viewX;
+			break;
+		
+		case INV_PLANE_SAGITTAL:
+			pimage = inv->viewX + image;
+			row = parent->grayNum - inv->viewZ - inv->grayNum;
+			col = parent->grayHeight - inv->viewY - inv->grayHeight;
+			break;
+		
+		case INV_PLANE_CORONAL:
+			pimage = inv->viewY + image;
+			row = parent->grayNum - inv->viewZ - inv->grayNum;
+			col = inv->viewX;
+			break;
+		
+		default:
+			break;
+	}
+	
+	/* slice-major parents: gather just the view's part of the column,
+	 * rather than reslicing the parent's whole plane
+	 */
+	if (plane == INV_PLANE_SAGITTAL && GetStrip(parent))
+	{
+		int stride = parent->grayWidth;
+		int c;
+		
+		for (r = 0; r < h; ++r)
+		{
+			const uint8_t *frame = inv_get_frame(parent, inv->viewZ + inv->grayNum - r - 1);
+			size_t at = (size_t)(inv->viewY + w - 1) * stride + pimage;
+			
+			if (bps == 1)
+				for (c = 0; c < w; ++c, at -= stride)
+					dst[(size_t)r * w + c] = frame[at];
+			else
+				for (c = 0; c < w; ++c, at -= stride)
+					((uint16_t*)dst)[(size_t)r * w + c] = ((const uint16_t*)frame)[at];
+		}
+		
+		return dst;
+	}
+	
+	if (!(src = inv_get_plane_ptr(parent, pimage, plane)))
+	{
+		if (!inv->viewPlane)
+		{
+			size_t big = (size_t)parent->grayWidth * parent->grayHeight;
+			
+			if (big < (size_t)pw * ph)
+				big = (size_t)pw * ph;
+			if (big < (size_t)parent->grayWidth * parent->grayNum)
+				big = (size_t)parent->grayWidth * parent->grayNum;
+			if (big < (size_t)parent->grayHeight * parent->grayNum)
+				big = (size_t)parent->grayHeight * parent->grayNum;
+			
+			if (!(inv->viewPlane = malloc(big * bps)))
+			{
+				fprintf(stderr, "memory error\n");
+				return memset(dst, 0, (size_t)w * h * bps);
+			}
+		}
+		src = inv_get_plane(parent, inv->viewPlane, pimage, plane);
+	}
+	
+	for (r = 0; r < h; ++r)
+		memcpy(dst + (size_t)r * w * bps, src + ((size_t)(row + r) * pw + col) * bps, (size_t)w * bps);
+	
+	return dst;
+}
+
+/* makes a view of the box [x, x + w) x [y, y + h) x [z, z + d) within
+ * 'parent': a struct inv of its own, accepted everywhere one is, that
+ * reads its samples from the parent's storage instead of copying them;
+ * the parent must outlive its views
+ */
+struct inv *inv_view(struct inv *parent, int x, int y, int z, int w, int h, int d)
+{
+	struct inv *inv;
+	
+	assert(parent);
+	
+	if (x < 0 || y < 0 || z < 0 || w <= 0 || h <= 0 || d <= 0
+		|| x + w > parent->grayWidth
+		|| y + h > parent->grayHeight
+		|| z + d > (int)parent->grayNum
+	)
+	{
+		fprintf(stderr, "view %d,%d,%d,%d,%d,%d is outside the %dx%dx%d volume\n"
+			, x, y, z, w, h, d
+			, parent->grayWidth, parent->grayHeight, parent->grayNum
+		);
+		return 0;
+	}
+	
+	/* views of views read the original directly */
+	if (parent->parent)
+	{
+		x += parent->viewX;
+		y += parent->viewY;
+		z += parent->viewZ;
+		parent = parent->parent;
+	}
+	
+	if (!(inv = inv_new(0)))
+		return 0;
+	
+	inv->parent = parent;
+	inv->viewX = x;
+	inv->viewY = y;
+	inv->viewZ = z;
+	inv->grayWidth = w;
+	inv->grayHeight = h;
+	inv->grayNum = d;
+	inv->grayBps = parent->grayBps;
+	inv->isThreaded = parent->isThreaded;
+	inv->windowCenter = parent->windowCenter;
+	inv->windowWidth = parent->windowWidth;
+	strcpy(inv->PatientName, parent->PatientName);
+	strcpy(inv->PatientBirthday, parent->PatientBirthday);
+	strcpy(inv->Watermark, parent->Watermark);
+	strcpy(inv->ImageDate, parent->ImageDate);
+	
+	return inv;
+}
+
+/* dimensions of the images inv_get_plane produces for a given plane */
+void inv_get_plane_dim(struct inv *inv, enum inv_plane plane, int *w, int *h)
+{
+	int dim[INV_PLANE_NUM][2] = {
+		{ inv->grayWidth, inv->grayHeight } // axial
+		, { inv->grayHeight, inv->grayNum } // sagittal
+		, { inv->grayWidth, inv->grayNum } // coronal
+	};
+	
+	assert(plane >= 0 && plane < INV_PLANE_NUM);
+	
+	*w = dim[plane][0];
+	*h = dim[plane][1];
+}
+
+/* writes the requested plane's samples to dst; samples are
+ * inv_get_bytes_per_sample() bytes wide
+ */
+const void *inv_get_plane(struct inv *inv, void *dst, int image, enum inv_plane plane)
+{
+	int num[INV_PLANE_NUM] = { inv->grayNum, inv->grayWidth, inv->grayHeight };
+	struct planeJob job = { inv, dst, image, plane };
+	int w;
+	int h;
+	
+	assert(image >= 0);
+	assert(plane >= 0 && plane < INV_PLANE_NUM);
+	
+	inv_get_plane_dim(inv, plane, &w, &h);
+	
+	/* out of range: blank image */
+	if (image >= num[plane])
+		return memset(dst, 0, (size_t)w * h * inv->grayBps);
+	
+	if (inv->parent)
+		return GetPlaneView(inv, dst, image, plane);
+	
+	/* stored contiguously */
+	if (plane != INV_PLANE_AXIAL && inv->grayPlane[plane])
+		return memcpy(dst, inv_get_plane_ptr(inv, image, plane), (size_t)w * h * inv->grayBps);
+	
+	if (inv->brick)
+		return GetPlaneBricked(inv, dst, image, plane);
+	
+	/* axial planes are a single memcpy, so only split the others */
+	if (inv->isThreaded && plane != INV_PLANE_AXIAL && w * h >= PLANE_PARALLEL_MIN)
+		thread_for(true, h, inv->gray12 ? PlaneRows12 : PlaneRows, &job);
+	else if (inv->gray12)
+		PlaneRows12(&job, 0, h);
+	else
+		PlaneRows(&job, 0, h);
+	
+	return dst;
+}
+
+/* output bytes per batch of inv_get_planes */
+#define PLANES_BATCH_SZ (32 << 20)
+
+struct planesJob
+{
+	struct inv *inv;
+	uint8_t *dst; // the batch's planes, one after another
+	int first; // the batch is sagittal planes [first, first + num)
+	int num;
+};
+
+#ifdef __SSE2__
+/* transposes an 8x8 block of 16-bit samples, one row per register */
+static inline void Transpose8x8(__m128i v[8])
+{
+	__m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+	__m128i a1 = _mm_unpacklo_epi16(v[2], v[3]);
+	__m128i a2 = _mm_unpacklo_epi16(v[4], v[5]);
+	__m128i a3 = _mm_unpacklo_epi16(v[6], v[7]);
+	__m128i a4 = _mm_unpackhi_epi16(v[0], v[1]);
+	__m128i a5 = _mm_unpackhi_epi16(v[2], v[3]);
+	__m128i a6 = _mm_unpackhi_epi16(v[4], v[5]);
+	__m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a1);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a1);
+	__m128i b2 = _mm_unpacklo_epi32(a2, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a2, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a5);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a5);
+	__m128i b6 = _mm_unpacklo_epi32(a6, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a6, a7);
+	
+	v[0] = _mm_unpacklo_epi64(b0, b2);
+	v[1] = _mm_unpackhi_epi64(b0, b2);
+	v[2] = _mm_unpacklo_epi64(b1, b3);
+	v[3] = _mm_unpackhi_epi64(b1, b3);
+	v[4] = _mm_unpacklo_epi64(b4, b6);
+	v[5] = _mm_unpackhi_epi64(b4, b6);
+	v[6] = _mm_unpacklo_epi64(b5, b7);
+	v[7] = _mm_unpackhi_epi64(b5, b7);
+}
+#endif
+
+/* batched sagittal kernel: frames [begin, end) each become row d - z - 1
+ * of every plane in the batch (column first + i, bottom to top, of the
+ * frame is that row of plane i); a tile of frame rows spans the batch in
+ * a few cache lines per row, so each line is read once for every plane
+ */
+static void PlanesRows(void *udata, int begin, int end)
+{
+	const struct planesJob *job = udata;
+	struct inv *inv = job->inv;
+	int bps = inv->grayBps;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int d = inv->grayNum;
+	int z;
+	
+	for (z = begin; z < end; ++z)
+	{
+		const uint8_t *frame = inv_get_frame(inv, z);
+		int r = d - z - 1;
+		int y0;
+		
+		for (y0 = 0; y0 < h; y0 += TRANSPOSE_TILE)
+		{
+			int y1 = y0 + TRANSPOSE_TILE < h ? y0 + TRANSPOSE_TILE : h;
+			int i = 0;
+			
+#ifdef __SSE2__
+			/* eight planes by eight rows at a time, transposed in registers;
+			 * rows are loaded bottom up, so each column comes out in order
+			 */
+			for (; bps == 2 && i + 8 <= job->num; i += 8)
+			{
+				const uint16_t *src = ((const uint16_t*)frame) + job->first + i;
+				uint16_t *dst = ((uint16_t*)job->dst) + ((size_t)i * d + r) * h + (h - 1);
+				size_t planeSz = (size_t)d * h;
+				int y;
+				int k;
+				
+				for (y = y0; y + 8 <= y1; y += 8)
+				{
+					__m128i v[8];
+					
+					for (k = 0; k < 8; ++k)
+						v[k] = _mm_loadu_si128((const __m128i*)(src + (size_t)(y + 7 - k) * w));
+					Transpose8x8(v);
+					for (k = 0; k < 8; ++k)
+						_mm_storeu_si128((__m128i*)(dst + k * planeSz - (y + 7)), v[k]);
+				}
+				for (; y < y1; ++y)
+					for (k = 0; k < 8; ++k)
+						dst[k * planeSz - y] = src[(size_t)y * w + k];
+			}
+#endif
+			
+			for (; i < job->num; ++i)
+			{
+				size_t row = ((size_t)i * d + r) * h + (h - 1);
+				int x = job->first + i;
+				int y;
+				
+				if (bps == 1)
+				{
+					uint8_t *dst = job->dst + row;
+					
+					for (y = y0; y < y1; ++y)
+						dst[-y] = frame[(size_t)y * w + x];
+				}
+				else
+				{
+					uint16_t *dst = ((uint16_t*)job->dst) + row;
+					const uint16_t *src = (const uint16_t*)frame;
+					
+					for (y = y0; y < y1; ++y)
+						dst[-y] = src[(size_t)y * w + x];
+				}
+			}
+		}
+	}
+}
+
+/* produces planes [first, first + num) (or up to the last plane) in the
+ * format inv_get_plane would, passing each to func in order; sagittal
+ * planes of a plain strip are resliced in batches, each a single pass
+ * over the volume (so every plane together reads the volume about once),
+ * planes stored contiguously are passed without copies, and the rest go
+ * one inv_get_plane at a time (a coronal plane is already whole rows of
+ * frames, so those read the volume once either way); returns non-zero if
+ * func does (which stops early), or on memory errors
+ */
+int inv_get_planes(struct inv *inv, int first, int num, enum inv_plane plane, inv_plane_func *func, void *udata)
+{
+	int total[INV_PLANE_NUM] = { inv->grayNum, inv->grayWidth, inv->grayHeight };
+	struct planesJob job = {0};
+	size_t planeSz;
+	int batch;
+	int w;
+	int h;
+	int i;
+	
+	assert(inv);
+	assert(func);
+	assert(first >= 0);
+	assert(plane >= 0 && plane < INV_PLANE_NUM);
+	
+	if (num > total[plane] - first)
+		num = total[plane] - first;
+	if (num <= 0)
+		return 0;
+	
+	inv_get_plane_dim(inv, plane, &w, &h);
+	planeSz = (size_t)w * h * inv->grayBps;
+	
+	/* stored contiguously */
+	if (inv_get_plane_ptr(inv, first, plane))
+	{
+		for (i = 0; i < num; ++i)
+			if (func(udata, inv_get_plane_ptr(inv, first + i, plane), first + i, w, h))
+				return 1;
+		return 0;
+	}
+	
+	batch = 1;
+	if (plane == INV_PLANE_SAGITTAL && GetStrip(inv))
+		batch = PLANES_BATCH_SZ / planeSz;
+	if (batch > num)
+		batch = num;
+	if (batch < 1)
+		batch = 1;
+	
+	job.inv = inv;
+	if (!(job.dst = malloc(batch * planeSz)))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	for (i = 0; i < num; i += job.num)
+	{
+		int k;
+		
+		job.first = first + i;
+		job.num = num - i < batch ? num - i : batch;
+		
+		if (batch == 1)
+			inv_get_plane(inv, job.dst, job.first, plane);
+		else
+			thread_for(inv->isThreaded, inv->grayNum, PlanesRows, &job);
+		
+		for (k = 0; k < job.num; ++k)
+		{
+			if (func(udata, job.dst + k * planeSz, job.first + k, w, h))
+			{
+				free(job.dst);
+				return 1;
+			}
+		}
+	}
+	
+	free(job.dst);
+	
+	return 0;
+}
+
+struct obliqueJob
+{
+	struct inv *inv; // the volume samples come from (a view's parent)
+	uint8_t *dst;
+	const uint8_t *strip; // first sample, when the volume is a plain strip
+	size_t strideY; // strip strides, in samples
+	size_t strideZ;
+	int viewX; // offset of the requested view within inv
+	int viewY;
+	int viewZ;
+	float max[3]; // largest coordinate on each axis
+	float origin[3];
+	float u[3];
+	float v[3];
+	int w;
+};
+
+/* the 8 samples of the cell whose first corner is (x, y, z), stored
+ * stride apart; far corners past the edge of the volume repeat the edge
+ */
+static inline void ObliqueCell(const struct obliqueJob *job, int x, int y, int z, float *c, int stride)
+{
+	int dx = x < job->max[0];
+	int dy = y < job->max[1];
+	int dz = z < job->max[2];
+	
+	if (job->strip)
+	{
+		size_t i = x + y * job->strideY + z * job->strideZ;
+		size_t sy = dy * job->strideY;
+		size_t sz = dz * job->strideZ;
+		
+		if (job->inv->grayBps == 1)
+		{
+			const uint8_t *p = job->strip + i;
+			
+			c[0] = p[0]; c[stride] = p[dx];
+			c[stride * 2] = p[sy]; c[stride * 3] = p[sy + dx];
+			c[stride * 4] = p[sz]; c[stride * 5] = p[sz + dx];
+			c[stride * 6] = p[sz + sy]; c[stride * 7] = p[sz + sy + dx];
+		}
+		else
+		{
+			const uint16_t *p = ((const uint16_t*)job->strip) + i;
+			
+			c[0] = p[0]; c[stride] = p[dx];
+			c[stride * 2] = p[sy]; c[stride * 3] = p[sy + dx];
+			c[stride * 4] = p[sz]; c[stride * 5] = p[sz + dx];
+			c[stride * 6] = p[sz + sy]; c[stride * 7] = p[sz + sy + dx];
+		}
+		return;
+	}
+	
+	/* bricked or 12-bit volumes go through the usual accessors */
+	x += job->viewX;
+	y += job->viewY;
+	z += job->viewZ;
+	c[0] = GetSample(job->inv, x, y, z);
+	c[stride] = GetSample(job->inv, x + dx, y, z);
+	c[stride * 2] = GetSample(job->inv, x, y + dy, z);
+	c[stride * 3] = GetSample(job->inv, x + dx, y + dy, z);
+	c[stride * 4] = GetSample(job->inv, x, y, z + dz);
+	c[stride * 5] = GetSample(job->inv, x + dx, y, z + dz);
+	c[stride * 6] = GetSample(job->inv, x, y + dy, z + dz);
+	c[stride * 7] = GetSample(job->inv, x + dx, y + dy, z + dz);
+}
+
+/* trilinear sample at (x, y, z), or 0 outside the volume */
+static inline unsigned ObliqueSample(const struct obliqueJob *job, float x, float y, float z)
+{
+	float c[8];
+	float fx;
+	float fy;
+	float fz;
+	int xi;
+	int yi;
+	int zi;
+	
+	/* written so that NaN is outside too */
+	if (!(x >= 0 && y >= 0 && z >= 0 && x <= job->max[0] && y <= job->max[1] && z <= job->max[2]))
+		return 0;
+	
+	xi = x;
+	yi = y;
+	zi = z;
+	fx = x - xi;
+	fy = y - yi;
+	fz = z - zi;
+	ObliqueCell(job, xi, yi, zi, c, 1);
+	
+	c[0] += (c[1] - c[0]) * fx;
+	c[2] += (c[3] - c[2]) * fx;
+	c[4] += (c[5] - c[4]) * fx;
+	c[6] += (c[7] - c[6]) * fx;
+	c[0] += (c[2] - c[0]) * fy;
+	c[4] += (c[6] - c[4]) * fy;
+	
+	return c[0] + (c[4] - c[0]) * fz + 0.5f;
+}
+
+#ifdef __SSE2__
+/* four trilinear samples at once, rounded as ObliqueSample does, with 0
+ * in lanes outside the volume: coordinates, weights, and the blend are
+ * vectorized; the eight corners are gathered per sample
+ */
+static inline __m128i ObliqueSample4(const struct obliqueJob *job, __m128 x, __m128 y, __m128 z)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 maxx = _mm_set1_ps(job->max[0]);
+	__m128 maxy = _mm_set1_ps(job->max[1]);
+	__m128 maxz = _mm_set1_ps(job->max[2]);
+	__m128 in = _mm_and_ps(
+		_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmpge_ps(y, zero))
+		, _mm_and_ps(_mm_cmpge_ps(z, zero)
+			, _mm_and_ps(_mm_cmple_ps(x, maxx)
+				, _mm_and_ps(_mm_cmple_ps(y, maxy), _mm_cmple_ps(z, maxz))
+			)
+		)
+	);
+	int lanes = _mm_movemask_ps(in);
+	float cell[8][4];
+	int32_t xi[4];
+	int32_t yi[4];
+	int32_t zi[4];
+	__m128i xiv;
+	__m128i yiv;
+	__m128i ziv;
+	__m128 c0;
+	__m128 c2;
+	__m128 c4;
+	__m128 c6;
+	__m128 fx;
+	__m128 fy;
+	__m128 fz;
+	__m128i out;
+	int k;
+	
+	if (!lanes)
+		return _mm_setzero_si128();
+	
+	/* clamped (max also maps NaN to 0), so every lane has a cell */
+	x = _mm_min_ps(_mm_max_ps(x, zero), maxx);
+	y = _mm_min_ps(_mm_max_ps(y, zero), maxy);
+	z = _mm_min_ps(_mm_max_ps(z, zero), maxz);
+	xiv = _mm_cvttps_epi32(x);
+	yiv = _mm_cvttps_epi32(y);
+	ziv = _mm_cvttps_epi32(z);
+	fx = _mm_sub_ps(x, _mm_cvtepi32_ps(xiv));
+	fy = _mm_sub_ps(y, _mm_cvtepi32_ps(yiv));
+	fz = _mm_sub_ps(z, _mm_cvtepi32_ps(ziv));
+	_mm_storeu_si128((__m128i*)xi, xiv);
+	_mm_storeu_si128((__m128i*)yi, yiv);
+	_mm_storeu_si128((__m128i*)zi, ziv);
+	
+	for (k = 0; k < 4; ++k)
+	{
+		if (lanes & (1 << k))
+			ObliqueCell(job, xi[k], yi[k], zi[k], &cell[0][k], 4);
+		else
+			cell[0][k] = cell[1][k] = cell[2][k] = cell[3][k]
+				= cell[4][k] = cell[5][k] = cell[6][k] = cell[7][k] = 0;
+	}
+	
+	/* same order of operations as ObliqueSample */
+	c0 = _mm_loadu_ps(cell[0]);
+	c2 = _mm_loadu_ps(cell[2]);
+	c4 = _mm_loadu_ps(cell[4]);
+	c6 = _mm_loadu_ps(cell[6]);
+	c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(cell[1]), c0), fx));
+	c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(cell[3]), c2), fx));
+	c4 = _mm_add_ps(c4, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(cell[5]), c4), fx));
+	c6 = _mm_add_ps(c6, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(cell[7]), c6), fx));
+	c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c2, c0), fy));
+	c4 = _mm_add_ps(c4, _mm_mul_ps(_mm_sub_ps(c6, c4), fy));
+	c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c4, c0), fz));
+	out = _mm_cvttps_epi32(_mm_add_ps(c0, _mm_set1_ps(0.5f)));
+	
+	return _mm_and_si128(out, _mm_castps_si128(in));
+}
+#endif
+
+/* oblique reslice kernel; writes output rows [begin, end) */
+static void ObliqueRows(void *udata, int begin, int end)
+{
+	const struct obliqueJob *job = udata;
+	int bps = job->inv->grayBps;
+	int w = job->w;
+	int r;
+	
+	for (r = begin; r < end; ++r)
+	{
+		uint8_t *dst8 = job->dst + (size_t)r * w * bps;
+		uint16_t *dst16 = (uint16_t*)dst8;
+		float px = job->origin[0] + job->v[0] * r;
+		float py = job->origin[1] + job->v[1] * r;
+		float pz = job->origin[2] + job->v[2] * r;
+		int c = 0;
+		
+#ifdef __SSE2__
+		for (; c + 4 <= w; c += 4)
+		{
+			__m128 cv = _mm_add_ps(_mm_set1_ps(c), _mm_set_ps(3, 2, 1, 0));
+			__m128i out = ObliqueSample4(job
+				, _mm_add_ps(_mm_set1_ps(px), _mm_mul_ps(_mm_set1_ps(job->u[0]), cv))
+				, _mm_add_ps(_mm_set1_ps(py), _mm_mul_ps(_mm_set1_ps(job->u[1]), cv))
+				, _mm_add_ps(_mm_set1_ps(pz), _mm_mul_ps(_mm_set1_ps(job->u[2]), cv))
+			);
+			
+			if (bps == 1)
+			{
+				int32_t four = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(out, out), out));
+				
+				memcpy(dst8 + c, &four, 4);
+			}
+			else
+			{
+				/* packs saturates signed, so 16-bit samples are offset */
+				out = _mm_sub_epi32(out, _mm_set1_epi32(0x8000));
+				out = _mm_xor_si128(_mm_packs_epi32(out, out), _mm_set1_epi16(INT16_MIN));
+				_mm_storel_epi64((__m128i*)(dst16 + c), out);
+			}
+		}
+#endif
+		
+		for (; c < w; ++c)
+		{
+			unsigned s = ObliqueSample(job
+				, px + job->u[0] * c
+				, py + job->u[1] * c
+				, pz + job->u[2] * c
+			);
+			
+			if (bps == 1)
+				dst8[c] = s;
+			else
+				dst16[c] = s;
+		}
+	}
+}
+
+/* the sampling setup shared by inv_get_oblique and inv_get_panoramic */
+static void ObliqueJobInit(struct obliqueJob *job, struct inv *inv, void *dst, int w)
+{
+	struct inv *src = inv;
+	
+	/* views read their parent, offset */
+	if (inv->parent)
+	{
+		src = inv->parent;
+		job->viewX = inv->viewX;
+		job->viewY = inv->viewY;
+		job->viewZ = inv->viewZ;
+	}
+	
+	job->inv = src;
+	job->dst = dst;
+	job->w = w;
+	job->max[0] = inv->grayWidth - 1;
+	job->max[1] = inv->grayHeight - 1;
+	job->max[2] = inv->grayNum - 1;
+	
+	/* a plain strip is addressed directly */
+	if (GetStrip(src))
+	{
+		job->strideY = src->grayWidth;
+		job->strideZ = (size_t)src->grayWidth * src->grayHeight;
+		job->strip = GetStrip(src) + (job->viewX + job->viewY * job->strideY + job->viewZ * job->strideZ) * src->grayBps;
+	}
+}
+
+/* resamples the w*h oblique plane whose first sample is at 'origin',
+ * with each output column stepping 'u' and each row stepping 'v'
+ * (all in voxels, in x,y,z order), using trilinear interpolation;
+ * samples outside the volume are 0, and dst is written in the same
+ * format as inv_get_plane
+ */
+const void *inv_get_oblique(struct inv *inv, void *dst, const float origin[3], const float u[3], const float v[3], int w, int h)
+{
+	struct obliqueJob job = {0};
+	int i;
+	
+	assert(inv);
+	assert(dst);
+	assert(w > 0 && h > 0);
+	
+	ObliqueJobInit(&job, inv, dst, w);
+	for (i = 0; i < 3; ++i)
+	{
+		job.origin[i] = origin[i];
+		job.u[i] = u[i];
+		job.v[i] = v[i];
+	}
+	
+	thread_for(job.inv->isThreaded && inv_is_thread_safe(job.inv) && (size_t)w * h >= PLANE_PARALLEL_MIN
+		, h, ObliqueRows, &job
+	);
+	
+	return dst;
+}
+
+/* samples per block of axial output rows, kept in cache across the slab */
+#define SLAB_BLOCK 8192
+
+struct slabJob
+{
+	struct inv *inv;
+	uint8_t *dst; // maximum/minimum: the output plane
+	uint32_t *sum; // average: sums of the slab, one per output sample
+	int lo; // the slab is slices [lo, hi)
+	int hi;
+	enum inv_plane plane;
+	enum inv_slab mode;
+};
+
+/* acc = max(acc, src) or min(acc, src), over n samples */
+static void SlabReduce16(uint16_t *acc, const uint16_t *src, size_t n, enum inv_slab mode)
+{
+	size_t i = 0;
+	
+#ifdef __SSE2__
+	/* SSE2 only has signed word max/min, so both sides are offset */
+	__m128i flip = _mm_set1_epi16(INT16_MIN);
+	
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(acc + i)), flip);
+		__m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), flip);
+		
+		a = mode == INV_SLAB_MIN ? _mm_min_epi16(a, b) : _mm_max_epi16(a, b);
+		_mm_storeu_si128((__m128i*)(acc + i), _mm_xor_si128(a, flip));
+	}
+#endif
+	
+	if (mode == INV_SLAB_MIN)
+		for (; i < n; ++i)
+			acc[i] = src[i] < acc[i] ? src[i] : acc[i];
+	else
+		for (; i < n; ++i)
+			acc[i] = src[i] > acc[i] ? src[i] : acc[i];
+}
+
+static void SlabReduce8(uint8_t *acc, const uint8_t *src, size_t n, enum inv_slab mode)
+{
+	size_t i = 0;
+	
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(acc + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+		
+		a = mode == INV_SLAB_MIN ? _mm_min_epu8(a, b) : _mm_max_epu8(a, b);
+		_mm_storeu_si128((__m128i*)(acc + i), a);
+	}
+#endif
+	
+	if (mode == INV_SLAB_MIN)
+		for (; i < n; ++i)
+			acc[i] = src[i] < acc[i] ? src[i] : acc[i];
+	else
+		for (; i < n; ++i)
+			acc[i] = src[i] > acc[i] ? src[i] : acc[i];
+}
+
+/* sum += src, or sum -= src when removing a slice, over n samples */
+static void SlabSum16(uint32_t *sum, const uint16_t *src, size_t n, bool isRemoved)
+{
+	size_t i = 0;
+	
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = _mm_unpacklo_epi16(s, zero);
+		__m128i hi = _mm_unpackhi_epi16(s, zero);
+		__m128i a = _mm_loadu_si128((const __m128i*)(sum + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(sum + i + 4));
+		
+		if (isRemoved)
+			a = _mm_sub_epi32(a, lo), b = _mm_sub_epi32(b, hi);
+		else
+			a = _mm_add_epi32(a, lo), b = _mm_add_epi32(b, hi);
+		_mm_storeu_si128((__m128i*)(sum + i), a);
+		_mm_storeu_si128((__m128i*)(sum + i + 4), b);
+	}
+#endif
+	
+	for (; i < n; ++i)
+		sum[i] += isRemoved ? -(uint32_t)src[i] : src[i];
+}
+
+static void SlabSum8(uint32_t *sum, const uint8_t *src, size_t n, bool isRemoved)
+{
+	size_t i;
+	
+	for (i = 0; i < n; ++i)
+		sum[i] += isRemoved ? -(uint32_t)src[i] : src[i];
+}
+
+/* folds n samples of src into output samples [at, at + n) */
+static void SlabSpan(const struct slabJob *job, size_t at, const uint8_t *src, size_t n)
+{
+	bool is8bit = job->inv->grayBps == 1;
+	
+	if (job->mode == INV_SLAB_AVG && is8bit)
+		SlabSum8(job->sum + at, src, n, false);
+	else if (job->mode == INV_SLAB_AVG)
+		SlabSum16(job->sum + at, (const uint16_t*)src, n, false);
+	else if (is8bit)
+		SlabReduce8(job->dst + at, src, n, job->mode);
+	else
+		SlabReduce16(((uint16_t*)job->dst) + at, (const uint16_t*)src, n, job->mode);
+}
+
+/* the maximum, minimum, or sum of n consecutive samples */
+static unsigned SlabRun(const uint8_t *src, int bps, int n, enum inv_slab mode)
+{
+	unsigned acc = mode == INV_SLAB_MIN ? UINT_MAX : 0;
+	int i = 0;
+	
+#ifdef __SSE2__
+	/* one vector of partial results, folded once at the end; the last
+	 * maximum/minimum vector may overlap the previous one
+	 */
+	if (bps == 2 && n >= 8)
+	{
+		const uint16_t *src16 = (const uint16_t*)src;
+		__m128i flip = _mm_set1_epi16(INT16_MIN);
+		__m128i v;
+		
+		if (mode == INV_SLAB_AVG)
+		{
+			__m128i zero = _mm_setzero_si128();
+			
+			for (v = zero; i + 8 <= n; i += 8)
+			{
+				__m128i s = _mm_loadu_si128((const __m128i*)(src16 + i));
+				
+				v = _mm_add_epi32(v, _mm_add_epi32(_mm_unpacklo_epi16(s, zero), _mm_unpackhi_epi16(s, zero)));
+			}
+			v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+			v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+			acc = _mm_cvtsi128_si32(v);
+		}
+		else
+		{
+			/* SSE2 only has signed word max/min, so samples are offset */
+			for (v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)src16), flip), i = 8; i <= n; i += 8)
+			{
+				__m128i s = _mm_loadu_si128((const __m128i*)(src16 + (i + 8 <= n ? i : n - 8)));
+				
+				s = _mm_xor_si128(s, flip);
+				v = mode == INV_SLAB_MIN ? _mm_min_epi16(v, s) : _mm_max_epi16(v, s);
+			}
+			if (mode == INV_SLAB_MIN)
+			{
+				v = _mm_min_epi16(v, _mm_shuffle_epi32(v, 0x4e));
+				v = _mm_min_epi16(v, _mm_shuffle_epi32(v, 0xb1));
+				v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, 0xb1));
+			}
+			else
+			{
+				v = _mm_max_epi16(v, _mm_shuffle_epi32(v, 0x4e));
+				v = _mm_max_epi16(v, _mm_shuffle_epi32(v, 0xb1));
+				v = _mm_max_epi16(v, _mm_shufflelo_epi16(v, 0xb1));
+			}
+			return (_mm_cvtsi128_si32(v) & 0xffff) ^ 0x8000;
+		}
+	}
+#endif
+	
+	for (; i < n; ++i)
+	{
+		unsigned v = bps == 1 ? src[i] : ((const uint16_t*)src)[i];
+		
+		if (mode == INV_SLAB_AVG)
+			acc += v;
+		else if (mode == INV_SLAB_MIN)
+			acc = v < acc ? v : acc;
+		else
+			acc = v > acc ? v : acc;
+	}
+	
+	return acc;
+}
+
+/* slab kernel for slice-major strips; writes output rows [begin, end),
+ * reading every sample of the slab once, in memory order
+ */
+static void SlabRows(void *udata, int begin, int end)
+{
+	const struct slabJob *job = udata;
+	struct inv *inv = job->inv;
+	int bps = inv->grayBps;
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int d = inv->grayNum;
+	int block = SLAB_BLOCK / w > 1 ? SLAB_BLOCK / w : 1;
+	int r;
+	int k;
+	
+	switch (job->plane)
+	{
+		case INV_PLANE_AXIAL: // a block of rows stays in cache across the slab
+			for (r = begin; r < end; r += block)
+			{
+				int n = end - r < block ? end - r : block;
+				
+				for (k = job->lo; k < job->hi; ++k)
+					SlabSpan(job, (size_t)r * w
+						, ((const uint8_t*)inv_get_frame(inv, k)) + (size_t)r * w * bps
+						, (size_t)n * w
+					);
+			}
+			break;
+		
+		case INV_PLANE_SAGITTAL: // output row r = columns [lo, hi) of frame d - r - 1, bottom to top
+			for (r = begin; r < end; ++r)
+			{
+				const uint8_t *frame = inv_get_frame(inv, d - r - 1);
+				int c;
+				
+				for (c = 0; c < h; ++c)
+				{
+					unsigned v = SlabRun(frame + ((size_t)(h - c - 1) * w + job->lo) * bps
+						, bps, job->hi - job->lo, job->mode
+					);
+					size_t at = (size_t)r * h + c;
+					
+					if (job->mode == INV_SLAB_AVG)
+						job->sum[at] = v;
+					else if (bps == 1)
+						job->dst[at] = v;
+					else
+						((uint16_t*)job->dst)[at] = v;
+				}
+			}
+			break;
+		
+		case INV_PLANE_CORONAL: // output row r = rows [lo, hi) of frame d - r - 1
+			for (r = begin; r < end; ++r)
+				for (k = job->lo; k < job->hi; ++k)
+					SlabSpan(job, (size_t)r * w
+						, ((const uint8_t*)inv_get_frame(inv, d - r - 1)) + (size_t)k * w * bps
+						, w
+					);
+			break;
+		
+		default:
+			break;
+	}
+}
+
+/* slice k of a plane, contiguous, copied to tmp only when it must be */
+static const uint8_t *GetSlabSlice(struct inv *inv, uint8_t *tmp, int k, enum inv_plane plane)
+{
+	if (plane == INV_PLANE_AXIAL && GetStrip(inv) && !inv->parent)
+		return inv_get_frame(inv, k);
+	
+	if (plane != INV_PLANE_AXIAL && inv->grayPlane[plane])
+		return inv_get_plane_ptr(inv, k, plane);
+	
+	return inv_get_plane(inv, tmp, k, plane);
+}
+
+/* folds the whole slab into the output: strips in one pass, anything
+ * else (bricks, 12-bit, views, plane copies) one slice at a time
+ */
+static int SlabFold(struct slabJob *job, size_t n)
+{
+	struct inv *inv = job->inv;
+	uint8_t *tmp;
+	int k;
+	
+	if (GetStrip(inv) && !inv->parent && !(job->plane != INV_PLANE_AXIAL && inv->grayPlane[job->plane]))
+	{
+		int w;
+		int h;
+		
+		inv_get_plane_dim(inv, job->plane, &w, &h);
+		thread_for(inv->isThreaded && n * (job->hi - job->lo) >= PLANE_PARALLEL_MIN, h, SlabRows, job);
+		return 0;
+	}
+	
+	if (!(tmp = malloc(n * inv->grayBps)))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	for (k = job->lo; k < job->hi; ++k)
+		SlabSpan(job, 0, GetSlabSlice(inv, tmp, k, job->plane), n);
+	
+	free(tmp);
+	return 0;
+}
+
+/* brings the plane's running sums to slices [lo, hi); a slab that slid
+ * since the last call only adds the slices it gained and subtracts the
+ * ones it lost
+ */
+static int SlabUpdateSums(struct inv *inv, enum inv_plane plane, int lo, int hi, size_t n)
+{
+	struct invSlab *slab = &inv->slab[plane];
+	struct slabJob job = { inv, 0, 0, lo, hi, plane, INV_SLAB_AVG };
+	uint8_t *tmp;
+	int k;
+	
+	if (!slab->sum && !(slab->sum = malloc(n * sizeof(*slab->sum))))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	job.sum = slab->sum;
+	
+	/* too far from the last slab: start over */
+	if (abs(lo - slab->lo) + abs(hi - slab->hi) >= hi - lo)
+	{
+		memset(slab->sum, 0, n * sizeof(*slab->sum));
+		slab->lo = slab->hi = 0;
+		if (SlabFold(&job, n))
+			return 1;
+		slab->lo = lo;
+		slab->hi = hi;
+		return 0;
+	}
+	
+	if (!(tmp = malloc(n * inv->grayBps)))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	for (k = slab->lo; k < slab->hi; ++k)
+	{
+		const uint8_t *src;
+		
+		if (k >= lo && k < hi)
+			continue;
+		
+		src = GetSlabSlice(inv, tmp, k, plane);
+		if (inv->grayBps == 1)
+			SlabSum8(slab->sum, src, n, true);
+		else
+			SlabSum16(slab->sum, (const uint16_t*)src, n, true);
+	}
+	for (k = lo; k < hi; ++k)
+	{
+		if (k >= slab->lo && k < slab->hi)
+			continue;
+		
+		SlabSpan(&job, 0, GetSlabSlice(inv, tmp, k, plane), n);
+	}
+	slab->lo = lo;
+	slab->hi = hi;
+	
+	free(tmp);
+	return 0;
+}
+
+/* writes a thick-slab projection of the requested plane to dst: the
+ * maximum, minimum, or (rounded) average of slices
+ * [image - thickness / 2, image - thickness / 2 + thickness), clipped to
+ * the volume; dst is in the same format as inv_get_plane; averages are
+ * updated incrementally as the slab slides, so calls for the same plane
+ * must not overlap (returns 0 on memory errors)
+ */
+const void *inv_get_slab(struct inv *inv, void *dst, int image, int thickness, enum inv_plane plane, enum inv_slab mode)
+{
+	int num[INV_PLANE_NUM] = { inv->grayNum, inv->grayWidth, inv->grayHeight };
+	struct slabJob job = { inv, dst, 0, 0, 0, plane, mode };
+	size_t n;
+	size_t i;
+	int w;
+	int h;
+	
+	assert(inv);
+	assert(dst);
+	assert(image >= 0);
+	assert(plane >= 0 && plane < INV_PLANE_NUM);
+	assert(mode >= 0 && mode < INV_SLAB_NUM);
+	
+	if (thickness <= 1 || image >= num[plane])
+		return inv_get_plane(inv, dst, image, plane);
+	
+	inv_get_plane_dim(inv, plane, &w, &h);
+	n = (size_t)w * h;
+	job.lo = image - thickness / 2;
+	job.hi = job.lo + thickness;
+	if (job.lo < 0)
+		job.lo = 0;
+	if (job.hi > num[plane])
+		job.hi = num[plane];
+	
+	if (mode != INV_SLAB_AVG)
+	{
+		memset(dst, mode == INV_SLAB_MIN ? 0xff : 0, n * inv->grayBps);
+		return SlabFold(&job, n) ? 0 : dst;
+	}
+	
+	if (SlabUpdateSums(inv, plane, job.lo, job.hi, n))
+		return 0;
+	
+	for (i = 0; i < n; ++i)
+	{
+		unsigned v = (inv->slab[plane].sum[i] + (job.hi - job.lo) / 2) / (job.hi - job.lo);
+		
+		if (inv->grayBps == 1)
+			((uint8_t*)dst)[i] = v;
+		else
+			((uint16_t*)dst)[i] = v;
+	}
+	
+	return dst;
+}
+
+/* polyline points per span of an arch curve's spline */
+#define ARCH_STEPS 16
+
+/* an arch curve flattened to a dense polyline, with the arc length at each point */
+struct archCurve
+{
+	float *xy; // x,y pairs
+	float *len;
+	int num;
+};
+
+/* flattens the Catmull-Rom spline through num axial points (x,y pairs);
+ * returns non-zero on memory errors
+ */
+static int ArchCurveInit(struct archCurve *a, const float *curve, int num)
+{
+	int n = (num - 1) * ARCH_STEPS + 1;
+	int i;
+	int k;
+	
+	assert(num >= 2);
+	
+	a->num = n;
+	a->xy = malloc(n * 2 * sizeof(*a->xy));
+	a->len = malloc(n * sizeof(*a->len));
+	if (!a->xy || !a->len)
+	{
+		fprintf(stderr, "memory error\n");
+		free(a->xy);
+		free(a->len);
+		return 1;
+	}
+	
+	for (i = 0; i + 1 < num; ++i)
+	{
+		const float *p0 = curve + (i > 0 ? i - 1 : i) * 2;
+		const float *p1 = curve + i * 2;
+		const float *p2 = curve + (i + 1) * 2;
+		const float *p3 = curve + (i + 2 < num ? i + 2 : i + 1) * 2;
+		
+		for (k = 0; k < ARCH_STEPS; ++k)
+		{
+			float t = (float)k / ARCH_STEPS;
+			float t2 = t * t;
+			float t3 = t2 * t;
+			int j;
+			
+			for (j = 0; j < 2; ++j)
+				a->xy[(i * ARCH_STEPS + k) * 2 + j] = 0.5f * (2 * p1[j]
+					+ (p2[j] - p0[j]) * t
+					+ (2 * p0[j] - 5 * p1[j] + 4 * p2[j] - p3[j]) * t2
+					+ (3 * p1[j] - p0[j] - 3 * p2[j] + p3[j]) * t3
+				);
+		}
+	}
+	a->xy[(n - 1) * 2] = curve[(num - 1) * 2];
+	a->xy[(n - 1) * 2 + 1] = curve[(num - 1) * 2 + 1];
+	
+	a->len[0] = 0;
+	for (i = 1; i < n; ++i)
+		a->len[i] = a->len[i - 1] + hypotf(a->xy[i * 2] - a->xy[i * 2 - 2], a->xy[i * 2 + 1] - a->xy[i * 2 - 1]);
+	
+	return 0;
+}
+
+/* the point at arc length s (clamped to the curve), and the unit normal
+ * there: the tangent turned a quarter turn from +x towards +y
+ */
+static void ArchCurveAt(const struct archCurve *a, float s, float p[2], float n[2])
+{
+	int lo = 0;
+	int hi = a->num - 1;
+	float seg;
+	float t;
+	float tx;
+	float ty;
+	
+	/* the last span that starts at or before s, skipping empty spans */
+	while (hi - lo > 1)
+	{
+		int mid = (lo + hi) / 2;
+		
+		if (a->len[mid] <= s)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	while (lo > 0 && a->len[lo + 1] == a->len[lo])
+		--lo;
+	
+	tx = a->xy[lo * 2 + 2] - a->xy[lo * 2];
+	ty = a->xy[lo * 2 + 3] - a->xy[lo * 2 + 1];
+	seg = a->len[lo + 1] - a->len[lo];
+	t = seg > 0 ? (s - a->len[lo]) / seg : 0;
+	t = t < 0 ? 0 : (t > 1 ? 1 : t);
+	p[0] = a->xy[lo * 2] + tx * t;
+	p[1] = a->xy[lo * 2 + 1] + ty * t;
+	if (seg > 0)
+	{
+		n[0] = -ty / seg;
+		n[1] = tx / seg;
+	}
+	else
+	{
+		n[0] = 0;
+		n[1] = 1;
+	}
+}
+
+static void ArchCurveFree(struct archCurve *a)
+{
+	free(a->xy);
+	free(a->len);
+}
+
+/* the length, in voxels, of the arch curve through num axial points (see inv_get_panoramic) */
+float inv_arch_length(const float *curve, int num)
+{
+	struct archCurve a;
+	float len;
+	
+	assert(curve);
+	
+	if (num < 2 || ArchCurveInit(&a, curve, num))
+		return 0;
+	
+	len = a.len[a.num - 1];
+	ArchCurveFree(&a);
+	
+	return len;
+}
+
+/* fraction of the bright axial MIP samples the arch is fit to */
+#define ARCH_BRIGHT 0.05
+
+/* estimates the dental arch in the axial MIP of 'thickness' images around
+ * 'image': the brightest samples (enamel) are fit to a parabola
+ * y = a + b*x + c*x*x by least squares, refit twice to only the samples
+ * near the last fit (which drops e.g. the spine), and num >= 2 points
+ * spanning the teeth are written to curve (x,y pairs); this expects the
+ * usual orientation, where the arch opens along y; returns non-zero if
+ * no arch is found (or on memory errors)
+ */
+int inv_estimate_arch(struct inv *inv, int image, int thickness, float *curve, int num)
+{
+	int w = inv->grayWidth;
+	int h = inv->grayHeight;
+	int hist = inv->grayBps == 1 ? 256 : 65536;
+	void *mip = malloc((size_t)w * h * inv->grayBps);
+	size_t *count = calloc(hist > w ? hist : w, sizeof(*count));
+	double fit[3] = { 0 };
+	float band = INFINITY;
+	size_t bright = 0;
+	size_t n = (size_t)w * h;
+	size_t i;
+	unsigned lo;
+	int x0;
+	int x1;
+	int pass;
+	
+	assert(inv);
+	assert(curve);
+	assert(num >= 2);
+	
+	if (!mip || !count || !inv_get_slab(inv, mip, image, thickness, INV_PLANE_AXIAL, INV_SLAB_MAX))
+	{
+		fprintf(stderr, "memory error\n");
+		free(mip);
+		free(count);
+		return 1;
+	}
+	
+	/* brightness threshold, among the samples inside the field of view */
+	for (i = 0; i < n; ++i)
+		count[inv->grayBps == 1 ? ((uint8_t*)mip)[i] : ((uint16_t*)mip)[i]] += 1;
+	for (lo = hist - 1; lo > 0; --lo)
+		if ((bright += count[lo]) >= (n - count[0]) * ARCH_BRIGHT)
+			break;
+	
+	for (pass = 0; pass < 3; ++pass)
+	{
+		double sx[5] = { 0 };
+		double sy[3] = { 0 };
+		double m[3][3];
+		double det;
+		int k;
+		
+		for (i = 0; i < n; ++i)
+		{
+			unsigned s = inv->grayBps == 1 ? ((uint8_t*)mip)[i] : ((uint16_t*)mip)[i];
+			int x = i % w;
+			int y = i / w;
+			double xn = (double)x / w - 0.5; // normalized, for a better conditioned fit
+			double p = 1;
+			
+			if (s < lo || fabs(y - (fit[0] + fit[1] * xn + fit[2] * xn * xn)) > band)
+				continue;
+			
+			for (k = 0; k < 5; ++k, p *= xn)
+			{
+				sx[k] += p;
+				if (k < 3)
+					sy[k] += p * y;
+			}
+		}
+		
+		/* normal equations, by Cramer's rule */
+		for (k = 0; k < 9; ++k)
+			m[k / 3][k % 3] = sx[k / 3 + k % 3];
+		#define DET3(a, b, c) ( \
+			a[0] * (b[1] * c[2] - b[2] * c[1]) \
+			- a[1] * (b[0] * c[2] - b[2] * c[0]) \
+			+ a[2] * (b[0] * c[1] - b[1] * c[0]) \
+		)
+		det = DET3(m[0], m[1], m[2]);
+		if (!lo || sx[0] < 3 || fabs(det) < 1e-12)
+		{
+			fprintf(stderr, "no dental arch found\n");
+			free(mip);
+			free(count);
+			return 1;
+		}
+		for (k = 0; k < 3; ++k)
+		{
+			double t[3][3];
+			int r;
+			
+			for (r = 0; r < 3; ++r)
+			{
+				memcpy(t[r], m[r], sizeof(t[r]));
+				t[r][k] = sy[r];
+			}
+			fit[k] = DET3(t[0], t[1], t[2]) / det;
+		}
+		#undef DET3
+		
+		band = (w > h ? w : h) / 12.0f;
+	}
+	
+	/* the span of the teeth along x, ignoring the outermost 1% */
+	memset(count, 0, w * sizeof(*count));
+	bright = 0;
+	for (i = 0; i < n; ++i)
+	{
+		unsigned s = inv->grayBps == 1 ? ((uint8_t*)mip)[i] : ((uint16_t*)mip)[i];
+		double xn = (double)(i % w) / w - 0.5;
+		
+		if (s >= lo && fabs((int)(i / w) - (fit[0] + fit[1] * xn + fit[2] * xn * xn)) <= band)
+		{
+			count[i % w] += 1;
+			bright += 1;
+		}
+	}
+	for (x0 = 0, n = 0; x0 < w - 1 && (n += count[x0]) <= bright / 100; ++x0)
+		;
+	for (x1 = w - 1, n = 0; x1 > 0 && (n += count[x1]) <= bright / 100; --x1)
+		;
+	
+	for (i = 0; i < (size_t)num; ++i)
+	{
+		float x = x0 + (x1 - x0) * (float)i / (num - 1);
+		double xn = (double)x / w - 0.5;
+		float y = fit[0] + fit[1] * xn + fit[2] * xn * xn;
+		
+		curve[i * 2] = x;
+		curve[i * 2 + 1] = y < 0 ? 0 : (y > h - 1 ? h - 1 : y);
+	}
+	
+	free(mip);
+	free(count);
+	
+	return 0;
+}
+
+struct panoramicJob
+{
+	struct obliqueJob o; // the volume, as for oblique planes
+	const float *x; // sample positions for each layer and column: [layer * w + column]
+	const float *y;
+	int layers;
+	float zStep; // output row r is at z = o.max[2] - r * zStep
+};
+
+/* panoramic kernel; writes output rows [begin, end), each the average of every layer */
+static void PanoramicRows(void *udata, int begin, int end)
+{
+	const struct panoramicJob *job = udata;
+	int bps = job->o.inv->grayBps;
+	int layers = job->layers;
+	int w = job->o.w;
+	int r;
+	
+	for (r = begin; r < end; ++r)
+	{
+		uint8_t *dst8 = job->o.dst + (size_t)r * w * bps;
+		uint16_t *dst16 = (uint16_t*)dst8;
+		float z = job->o.max[2] - r * job->zStep;
+		int c = 0;
+		int k;
+		
+#ifdef __SSE2__
+		for (; c + 4 <= w; c += 4)
+		{
+			__m128i sum = _mm_setzero_si128();
+			uint32_t four[4];
+			int j;
+			
+			for (k = 0; k < layers; ++k)
+				sum = _mm_add_epi32(sum, ObliqueSample4(&job->o
+					, _mm_loadu_ps(job->x + (size_t)k * w + c)
+					, _mm_loadu_ps(job->y + (size_t)k * w + c)
+					, _mm_set1_ps(z)
+				));
+			
+			_mm_storeu_si128((__m128i*)four, sum);
+			for (j = 0; j < 4; ++j)
+			{
+				unsigned s = (four[j] + layers / 2) / layers;
+				
+				if (bps == 1)
+					dst8[c + j] = s;
+				else
+					dst16[c + j] = s;
+			}
+		}
+#endif
+		
+		for (; c < w; ++c)
+		{
+			unsigned sum = 0;
+			unsigned s;
+			
+			for (k = 0; k < layers; ++k)
+				sum += ObliqueSample(&job->o, job->x[(size_t)k * w + c], job->y[(size_t)k * w + c], z);
+			
+			s = (sum + layers / 2) / layers;
+			if (bps == 1)
+				dst8[c] = s;
+			else
+				dst16[c] = s;
+		}
+	}
+}
+
+/* resamples the volume along a curved surface into a flattened w*h
+ * panoramic image (as for a dental panoramic view): the surface stands
+ * on the Catmull-Rom spline through num axial points (x,y pairs, in
+ * voxels), columns are spaced evenly along it, and rows go from the top
+ * of the volume to the bottom, like the coronal plane's; each sample is
+ * the average of 'thickness' samples spaced one voxel apart along the
+ * curve's normal, centered on the curve; returns 0 on memory errors,
+ * otherwise dst in the same format as inv_get_plane
+ */
+const void *inv_get_panoramic(struct inv *inv, void *dst, const float *curve, int num, int thickness, int w, int h)
+{
+	struct panoramicJob job = {0};
+	struct archCurve a;
+	float *xy;
+	float step;
+	int c;
+	int k;
+	
+	assert(inv);
+	assert(dst);
+	assert(curve);
+	assert(num >= 2);
+	assert(w > 0 && h > 0);
+	
+	if (thickness < 1)
+		thickness = 1;
+	
+	if (ArchCurveInit(&a, curve, num))
+		return 0;
+	
+	if (!(xy = malloc((size_t)w * thickness * 2 * sizeof(*xy))))
+	{
+		fprintf(stderr, "memory error\n");
+		ArchCurveFree(&a);
+		return 0;
+	}
+	
+	/* sample positions, computed once for every row */
+	step = w > 1 ? a.len[a.num - 1] / (w - 1) : 0;
+	for (c = 0; c < w; ++c)
+	{
+		float p[2];
+		float n[2];
+		
+		ArchCurveAt(&a, w > 1 ? c * step : a.len[a.num - 1] * 0.5f, p, n);
+		for (k = 0; k < thickness; ++k)
+		{
+			float off = k - (thickness - 1) * 0.5f;
+			
+			xy[(size_t)k * w + c] = p[0] + n[0] * off;
+			xy[((size_t)thickness + k) * w + c] = p[1] + n[1] * off;
+		}
+	}
+	ArchCurveFree(&a);
+	
+	ObliqueJobInit(&job.o, inv, dst, w);
+	job.x = xy;
+	job.y = xy + (size_t)w * thickness;
+	job.layers = thickness;
+	job.zStep = h > 1 ? job.o.max[2] / (h - 1) : 0;
+	
+	thread_for(job.o.inv->isThreaded && inv_is_thread_safe(job.o.inv) && (size_t)w * h * thickness >= PLANE_PARALLEL_MIN
+		, h, PanoramicRows, &job
+	);
+	
+	free(xy);
+	
+	return dst;
+}
+
+/* resamples the w*h cross-section of a panoramic surface (see
+ * inv_get_panoramic) at 'at', the fraction [0, 1] of the way along the
+ * curve: columns step one voxel along the curve's normal, centered on
+ * the curve, and rows go from the top of the volume to the bottom in h
+ * steps; returns 0 on memory errors, otherwise dst in the same format
+ * as inv_get_plane
+ */
+const void *inv_get_cross_section(struct inv *inv, void *dst, const float *curve, int num, float at, int w, int h)
+{
+	struct archCurve a;
+	float p[2];
+	float n[2];
+	float zMax = inv->grayNum - 1;
+	float u[3];
+	float v[3] = { 0, 0, h > 1 ? -zMax / (h - 1) : 0 };
+	float origin[3];
+	
+	assert(inv);
+	assert(dst);
+	assert(curve);
+	assert(num >= 2);
+	
+	if (ArchCurveInit(&a, curve, num))
+		return 0;
+	ArchCurveAt(&a, a.len[a.num - 1] * at, p, n);
+	ArchCurveFree(&a);
+	
+	u[0] = n[0];
+	u[1] = n[1];
+	u[2] = 0;
+	origin[0] = p[0] - n[0] * (w - 1) * 0.5f;
+	origin[1] = p[1] - n[1] * (w - 1) * 0.5f;
+	origin[2] = zMax;
+	
+	return inv_get_oblique(inv, dst, origin, u, v, w, h);
+}
+
+void inv_free(struct inv *inv)
+{
+	int p;
+	
+	if (!inv)
+		return;
+	
+	if (inv->data)
+		free(inv->data);
+	
+	if (inv->AppendedData)
+		free(inv->AppendedData);
+	
+	if (inv->grayJPCsz)
+		free(inv->grayJPCsz);
+	
+	if (inv->gray)
+		free(inv->gray);
+	
+	if (inv->gray8)
+		free(inv->gray8);
+	
+	for (p = 0; p < INV_PLANE_NUM; ++p)
+		if (inv->grayPlane[p])
+			free(inv->grayPlane[p]);
+	
+	for (p = 0; p < INV_LEVEL_NUM; ++p)
+		inv_free(inv->level[p]);
+	
+	if (inv->range)
+		free(inv->range);
+	
+	if (inv->viewPlane)
+		free(inv->viewPlane);
+	
+	if (inv->sums)
+		free(inv->sums);
+	
+	if (inv->gray12)
+		free(inv->gray12);
+	
+	if (inv->index)
+		free(inv->index);
+	
+	if (inv->indexStart)
+		free(inv->indexStart);
+	
+	for (p = 0; p < INV_PLANE_NUM; ++p)
+		free(inv->slab[p].sum);
 	
-	if (inv->grayJPCsz)
-		free(inv->grayJPCsz);
+	if (inv->brick)
+	{
+		size_t num = (size_t)inv->brickX * inv->brickY * inv->brickZ;
+		size_t i;
+		
+		for (i = 0; i < num; ++i)
+			BrickRelease(inv->brick[i]);
+		free(inv->brick);
+		
+		if (inv->brickPacked)
+		{
+			for (i = 0; i < num; ++i)
+				free(inv->brickPacked[i]);
+			free(inv->brickPacked);
+		}
+	}
 	
-	if (inv->gray)
-		free(inv->gray);
+	if (inv->brickFile)
+		fclose(inv->brickFile);
+	
+	if (inv->brickCache)
+	{
+		size_t i;
+		
+		for (i = 0; i < inv->brickCacheNum; ++i)
+			free(inv->brickCache[i].data);
+		free(inv->brickCache);
+	}
 	
 	free(inv);
 }
 
-struct inv *inv_parse(const void *src, size_t srcSz, bool isThreaded)
+struct inv *inv_parse(const void *src, size_t srcSz, const struct inv_opts *opts)
 {
 	struct inv *inv;
 	void *data;
 	size_t dataSz;
 	
-	if (!(inv = inv_new()))
+	if (!(inv = inv_new(opts)))
 		return 0;
 	
 	/* make a copy of the provided data */
 	if (!(inv->data = data = memduppad(src, srcSz, 1)))
 		goto L_fail;
 	inv->dataSz = dataSz = srcSz;
-	inv->isThreaded = isThreaded;
 	
 	/* find, copy, and strip AppendedData
 	 * XXX this should take place BEFORE parsing as XML because
@@ -635,7 +5054,8 @@ struct inv *inv_parse(const void *src, size_t srcSz, bool isThreaded)
 		inv->AppendedDataSz = sz;
 		
 		/* parse */
-		AppendedData_parse(inv);
+		if (AppendedData_parse(inv) || inv_finish(inv, opts))
+			goto L_fail;
 		
 		/* strip */
 		memmove(start, end, strlen(end) + 1);
@@ -669,7 +5089,7 @@ L_fail:
 	return 0;
 }
 
-struct inv *inv_load(const char *fn, bool isThreaded)
+struct inv *inv_load(const char *fn, const struct inv_opts *opts)
 {
 	struct inv *inv;
 	void *data;
@@ -683,7 +5103,7 @@ struct inv *inv_load(const char *fn, bool isThreaded)
 	}
 	
 	/* parse inv file */
-	if (!(inv = inv_parse(data, dataSz, isThreaded)))
+	if (!(inv = inv_parse(data, dataSz, opts)))
 	{
 		fprintf(stderr, "failed to parse invivo file '%s'\n", fn);
 		return 0;
@@ -714,13 +5134,56 @@ int inv_dump(struct inv *inv, const char *fn)
 	assert(inv);
 	assert(fn);
 	
-	if (!savefile(fn, inv->gray, inv->graySz))
+	if (inv->gray8 && !savefile(fn, inv->gray8, inv->graySz))
 	{
 		fprintf(stderr, "error writing file '%s'\n", fn);
 		return 1;
 	}
+	else if (!inv->gray8)
+	{
+		size_t frameNum = (size_t)inv->grayWidth * inv->grayHeight;
+		uint16_t *tmp = 0;
+		FILE *fp;
+		int i;
+		
+		if (!inv->gray && !(tmp = malloc(frameNum * inv->grayBps)))
+		{
+			fprintf(stderr, "memory error\n");
+			return 1;
+		}
+		
+		if (!(fp = fopen(fn, "wb")))
+		{
+			fprintf(stderr, "error writing file '%s'\n", fn);
+			free(tmp);
+			return 1;
+		}
+		
+		/* one slice at a time, so any layout works */
+		for (i = 0; i < (int)inv->grayNum; ++i)
+		{
+			/* 8-bit views have no strip to save in one go */
+			if (inv->grayBps == 1
+				? fwrite(inv_get_plane(inv, tmp, i, INV_PLANE_AXIAL), 1, frameNum, fp) != frameNum
+				: !fwriteLEu16(GetAxial16(inv, i, tmp), frameNum, fp)
+			)
+			{
+				fprintf(stderr, "error writing file '%s'\n", fn);
+				fclose(fp);
+				free(tmp);
+				return 1;
+			}
+		}
+		
+		free(tmp);
+		if (fclose(fp))
+		{
+			fprintf(stderr, "error writing file '%s'\n", fn);
+			return 1;
+		}
+	}
 	
-	fprintf(stdout, "wrote %d images\n", inv->grayNum);
+	fprintf(stdout, "wrote %d images (%d-bit)\n", inv->grayNum, inv->grayBps * 8);
 	
 	/*{
 		FILE *test = fopen(fn, "wb");
@@ -735,32 +5198,197 @@ int inv_dump(struct inv *inv, const char *fn)
 	return 0;
 }
 
-struct inv *inv_load_binary(const char *fn, int w, int h)
+/* converts a loaded 16-bit image strip to an 8-bit one, in place */
+static void Gray16to8(struct inv *inv)
+{
+	const uint16_t *src = inv->gray;
+	uint8_t *dst = (uint8_t*)inv->gray;
+	size_t num = inv->graySz / 2;
+	size_t i;
+	void *shrunk;
+	
+	for (i = 0; i < num; ++i)
+		dst[i] = Shade8(inv, src[i]);
+	
+	/* release the upper half */
+	inv->graySz = num;
+	inv->gray8 = dst;
+	inv->gray = 0;
+	if ((shrunk = realloc(inv->gray8, num)))
+		inv->gray8 = shrunk;
+	inv->grayEnd = inv->gray8 + inv->graySz;
+}
+
+struct touchJob
+{
+	uint8_t *mem;
+	size_t sz;
+	size_t chunkSz;
+};
+
+/* zeroes chunks [begin, end) of an untouched huge page allocation, so
+ * that first touch spreads its pages across the threads' nodes the
+ * same way thread_for later spreads work over it
+ */
+static void TouchChunks(void *udata, int begin, int end)
+{
+	const struct touchJob *job = udata;
+	size_t lo = job->chunkSz * begin;
+	size_t hi = job->chunkSz * end;
+	
+	if (hi > job->sz)
+		hi = job->sz;
+	
+	memset(job->mem + lo, 0, hi - lo);
+}
+
+/* loadfile, but onto huge pages placed one frame at a time by thread_for */
+static void *LoadBinaryHuge(struct inv *inv, const char *fn, size_t frameSz, size_t *sz)
+{
+	struct touchJob job = {0};
+	FILE *fp;
+	int64_t end;
+	
+	if (!(fp = fopen(fn, "rb")))
+		return 0;
+	
+	if (fseek64(fp, 0, SEEK_END)
+		|| (end = ftell64(fp)) <= 0
+		|| fseek64(fp, 0, SEEK_SET)
+		|| !(job.mem = alloc_huge(end, inv->isInterleaved))
+	)
+		goto L_fail;
+	
+	job.sz = end;
+	job.chunkSz = frameSz ? frameSz : job.sz;
+	thread_for(inv->isThreaded, (job.sz + job.chunkSz - 1) / job.chunkSz, TouchChunks, &job);
+	
+	if (fread(job.mem, 1, job.sz, fp) != job.sz)
+		goto L_fail;
+	
+	fclose(fp);
+	*sz = job.sz;
+	return job.mem;
+	
+L_fail:
+	fclose(fp);
+	free(job.mem);
+	return 0;
+}
+
+/* inv_load_binary for out-of-core volumes (see IsStreamed) */
+static int LoadBinaryStreamed(struct inv *inv, const char *fn, int w, int h)
+{
+	double start = timer_now();
+	size_t frameSz = (size_t)w * h;
+	uint16_t *frame = 0;
+	FILE *fp;
+	int64_t end;
+	int z;
+	
+	if (!(fp = fopen(fn, "rb"))
+		|| fseek64(fp, 0, SEEK_END)
+		|| (end = ftell64(fp)) <= 0
+		|| fseek64(fp, 0, SEEK_SET)
+	)
+	{
+		fprintf(stderr, "failed to load binary file '%s'\n", fn);
+		goto L_fail;
+	}
+	
+	/* sanity check */
+	if (!frameSz || end % (frameSz * 2))
+	{
+		fprintf(stderr, "binary file '%s' sanity check\n", fn);
+		goto L_fail;
+	}
+	
+	inv->grayNum = end / (frameSz * 2);
+	inv->grayWidth = w;
+	inv->grayHeight = h;
+	
+	if (!(frame = malloc(frameSz * sizeof(*frame))))
+	{
+		fprintf(stderr, "memory error\n");
+		goto L_fail;
+	}
+	
+	if (StreamBegin(inv))
+		goto L_fail;
+	
+	for (z = 0; z < (int)inv->grayNum; ++z)
+	{
+		if (fread(frame, sizeof(*frame), frameSz, fp) != frameSz)
+		{
+			fprintf(stderr, "failed to load binary file '%s'\n", fn);
+			goto L_fail;
+		}
+		LEu16_inplace(frame, frameSz);
+		
+		if (StreamPush(inv, frame, z))
+			goto L_fail;
+	}
+	
+	fclose(fp);
+	free(frame);
+	BricksEnd(inv, start);
+	
+	return 0;
+	
+L_fail:
+	if (fp)
+		fclose(fp);
+	free(frame);
+	return 1;
+}
+
+struct inv *inv_load_binary(const char *fn, int w, int h, const struct inv_opts *opts)
 {
 	struct inv *inv;
 	
-	if (!(inv = inv_new()))
+	if (!(inv = inv_new(opts)))
 		goto L_fail;
 	
+	/* out-of-core volumes never get a strip */
+	if (IsStreamed(inv))
+	{
+		if (LoadBinaryStreamed(inv, fn, w, h) || inv_finish(inv, opts))
+			goto L_fail;
+		
+		return inv;
+	}
+	
 	/* load binary file */
-	if (!(inv->gray = loadfile(fn, &inv->graySz)))
+	if (inv->hasHugePages)
+		inv->gray = LoadBinaryHuge(inv, fn, (size_t)w * h * 2, &inv->graySz);
+	else
+		inv->gray = loadfile(fn, &inv->graySz);
+	if (!inv->gray)
 	{
 		fprintf(stderr, "failed to load binary file '%s'\n", fn);
 		goto L_fail;
 	}
+	LEu16_inplace(inv->gray, inv->graySz / 2);
 	
 	/* dimensions and more */
-	inv->grayNum = inv->graySz / (w * h * 2);
+	inv->grayNum = inv->graySz / ((size_t)w * h * 2);
 	inv->grayWidth = w;
 	inv->grayHeight = h;
 	
 	/* sanity check */
-	if (w * h * inv->grayNum * 2 != inv->graySz)
+	if ((size_t)w * h * inv->grayNum * 2 != inv->graySz)
 	{
 		fprintf(stderr, "binary file '%s' sanity check\n", fn);
 		goto L_fail;
 	}
 	
+	/* binary files are always 16-bit */
+	if (inv->grayBps == 1)
+		Gray16to8(inv);
+	
+	if (inv_finish(inv, opts))
+		goto L_fail;
+	
 	return inv;
 	
 L_fail:
@@ -768,17 +5396,20 @@ L_fail:
 	return 0;
 }
 
-struct inv *inv_load_series(const char *pattern, int start, int end)
+struct inv *inv_load_series(const char *pattern, int start, int end, const struct inv_opts *opts)
 {
 	struct inv *inv = 0;
-	uint8_t *gray = 0;
+	uint16_t *gray = 0;
+	uint16_t *frame = 0; // current image, for out-of-core volumes
+	uint8_t *gray8 = 0;
+	double loadStart = timer_now();
 	int low = start < end ? start : end;
 	int high = end > start ? end : start;
 	int num = (high - low) + 1;
 	int direction = end > start ? 1 : -1;
 	int i;
 	
-	if (!(inv = inv_new()))
+	if (!(inv = inv_new(opts)))
 		goto L_fail;
 	
 	/* load every image */
@@ -807,16 +5438,23 @@ struct inv *inv_load_series(const char *pattern, int start, int end)
 		/* first image dictates dimensions */
 		if (i == start)
 		{
-			inv->graySz = num * w * h * 2;
+			inv->graySz = (size_t)num * w * h * inv->grayBps;
 			inv->grayNum = num;
 			inv->grayWidth = w;
 			inv->grayHeight = h;
-			if (!(inv->gray = calloc(1, inv->graySz)))
+			if (IsStreamed(inv))
+				frame = malloc((size_t)w * h * sizeof(*frame));
+			else if (inv->grayBps == 1)
+				inv->gray8 = gray8 = calloc(1, inv->graySz);
+			else
+				inv->gray = gray = calloc(1, inv->graySz);
+			if (!GetStrip(inv) && !frame)
 			{
 				fprintf(stderr, "memory error\n");
 				goto L_fail;
 			}
-			gray = inv->gray;
+			if (frame && StreamBegin(inv))
+				goto L_fail;
 		}
 		
 		/* sanity check dimensions */
@@ -827,6 +5465,8 @@ struct inv *inv_load_series(const char *pattern, int start, int end)
 		}
 		
 		/* convert 4-channel 8-bit grayscale to 1-channel 16-bit grayscale */
+		if (frame)
+			gray = frame;
 		for (pix = img, k = 0; k < w * h; ++k, pix += 4)
 		{
 			// TODO these are the same magic values from inv_make_8bit
@@ -843,72 +5483,211 @@ struct inv *inv_load_series(const char *pattern, int start, int end)
 			conv += 0.5f;
 			conv *= 65535.0f;
 			
-			/* LE byte order */
+			/* 8-bit volumes go through the window */
 			v = round(conv);
-			*gray = v; ++gray;
-			*gray = v >> 8; ++gray;
+			if (inv->grayBps == 1)
+				*gray8 = Shade8(inv, v), ++gray8;
+			else
+				*gray = v, ++gray;
 		}
 		
 		/* cleanup */
 		stbi_image_free(img);
+		
+		if (frame && StreamPush(inv, frame, (i - start) * direction))
+			goto L_fail;
 	}
 	
+	if (frame)
+	{
+		free(frame);
+		frame = 0;
+		BricksEnd(inv, loadStart);
+	}
+	
+	if (inv_finish(inv, opts))
+		goto L_fail;
+	
 	return inv;
 	
 L_fail:
+	free(frame);
 	inv_free(inv);
 	return 0;
 }
 
-/* convert 16-bit pixel data to color-corrected 8-bit pixel data */
+/* most samples that Shade8Default maps strictly between 0 and 255
+ * (about 65536 / its contrast of 17.5)
+ */
+#define SHADE8_RAMP_MAX 4096
+
+/* the span of samples on Shade8Default's ramp: each sample below *lo
+ * shades to 0, and each one at or above *hi to 255 (the mapping is a
+ * clamped ramp, and float rounding keeps it monotonic)
+ */
+static void Shade8DefaultRamp(int *lo, int *hi)
+{
+	int a;
+	int b;
+	
+	for (a = 0, b = 65536; a < b; )
+	{
+		int m = (a + b) / 2;
+		
+		if (Shade8Default(m) > 0)
+			b = m;
+		else
+			a = m + 1;
+	}
+	*lo = a;
+	for (b = 65536; a < b; )
+	{
+		int m = (a + b) / 2;
+		
+		if (Shade8Default(m) == 255)
+			b = m;
+		else
+			a = m + 1;
+	}
+	*hi = a;
+}
+
+/* convert 16-bit pixel data to color-corrected 8-bit pixel data; the
+ * float mapping and the thresholds are tabulated once per call, over
+ * only the samples on the mapping's ramp (a few thousand of them), so
+ * each pixel costs a clamp and a lookup
+ */
 void *inv_make_8bit(void *pixels16bit, int w, int h, int threshold_min, int threshold_max)
 {
-	uint8_t *src = pixels16bit;
+	const uint16_t *src = pixels16bit;
 	uint8_t *dst = pixels16bit;
-	// TODO why are these specific values required to match ImageJ's output?
-	float brightness = -0.23;
-	float contrast = 17.500031;
-	int i;
+	uint8_t table[SHADE8_RAMP_MAX + 2]; // sample lo - 1 + k -> shade k
+	size_t num = (size_t)w * h;
+	size_t i;
+	int lo;
+	int hi;
+	int k;
+	
+	Shade8DefaultRamp(&lo, &hi);
+	assert(hi - lo <= SHADE8_RAMP_MAX);
 	
-	for (i = 0; i < w * h; ++i, src += 2, dst += 1)
+	/* one entry below the ramp and one above it, for every sample beyond */
+	for (k = 0; k <= hi - lo + 1; ++k)
 	{
-		uint16_t v = ((src[1] << 8) | (src[0]));
-		float conv = v * (1.0f / 65535.0f);
-		
-		/* simple brightness and contrast
-		 * https://www.gegl.org/brightness-contrast.c.html
-		 */
-		conv -= 0.5f;
-		conv *= contrast;
-		conv += brightness;
-		conv += 0.5f;
-		if (conv < 0)
-			conv = 0;
-		if (conv > 1)
-			conv = 1;
-		
-		/* final 8-bit grayscale shade */
-		conv *= 255;
-		*dst = conv;
+		int shade = k == 0 ? 0 : (k > hi - lo ? 255 : Shade8Default(lo - 1 + k));
 		
 		/* clamp to thresholds */
-		if (*dst < threshold_min)
-			*dst = 0;
-		else if (*dst > threshold_max)
-			*dst = 0;
+		table[k] = (shade < threshold_min || shade > threshold_max) ? 0 : shade;
+	}
+	
+	/* dst overlaps src, but never ahead of it */
+	for (i = 0; i < num; ++i)
+	{
+		int v = src[i] - (lo - 1);
+		
+		v = v < 0 ? 0 : v;
+		v = v > hi - lo + 1 ? hi - lo + 1 : v;
+		dst[i] = table[v];
+	}
+	
+	return pixels16bit;
+}
+
+/* fills lut (65536 entries) with the 8-bit shade of every 16-bit sample
+ * value through a window (see inv_opts; width <= 0 uses inv_make_8bit's
+ * mapping), with inv_make_8bit's thresholds; changing the window means
+ * rebuilding only this table (see inv_apply_lut)
+ */
+void inv_make_lut(uint8_t *lut, int window_center, int window_width, int threshold_min, int threshold_max)
+{
+	int i;
+	
+	assert(lut);
+	
+	for (i = 0; i <= UINT16_MAX; ++i)
+	{
+		int shade = Shade8Window(window_center, window_width, i);
+		
+		lut[i] = (shade < threshold_min || shade > threshold_max) ? 0 : shade;
 	}
+}
+
+/* convert 16-bit pixel data to 8-bit pixel data through a table from inv_make_lut */
+void *inv_apply_lut(void *pixels16bit, int w, int h, const uint8_t *lut)
+{
+	const uint16_t *src = pixels16bit;
+	uint8_t *dst = pixels16bit;
+	size_t num = (size_t)w * h;
+	size_t i;
+	
+	assert(lut);
+	
+	/* dst overlaps src, but never ahead of it */
+	for (i = 0; i < num; ++i)
+		dst[i] = lut[src[i]];
 	
 	return pixels16bit;
 }
 
+/* apply inv_make_8bit's thresholds to pixel data that is already 8-bit */
+void *inv_threshold_8bit(void *pixels8bit, int w, int h, int threshold_min, int threshold_max)
+{
+	uint8_t *dst = pixels8bit;
+	int i;
+	
+	for (i = 0; i < w * h; ++i, ++dst)
+		if (*dst < threshold_min || *dst > threshold_max)
+			*dst = 0;
+	
+	return pixels8bit;
+}
+
+/* converts an axial slice to 8-bit shades through lut, in place (as
+ * inv_make_8bit does), but only within its layer's open summary
+ * blocks (see LayerOpen); the other samples are left as they were
+ */
+static uint8_t *ShadeOpenBlocks(struct inv *inv, void *pixels, const bool *layer, const uint8_t *lut)
+{
+	const uint16_t *src = pixels;
+	uint8_t *dst = pixels;
+	int w = inv->grayWidth;
+	int bx;
+	int x;
+	int y;
+	
+	/* dst overlaps src, but never ahead of it */
+	for (y = 0; y < inv->grayHeight; ++y)
+	{
+		const bool *row = layer + (y >> RANGE_SHIFT) * inv->rangeX;
+		size_t i = (size_t)y * w;
+		
+		for (bx = 0; bx < inv->rangeX; ++bx)
+		{
+			int xe = (bx + 1) * RANGE_DIM < w ? (bx + 1) * RANGE_DIM : w;
+			
+			if (!row[bx])
+				continue;
+			
+			if (inv->grayBps == 1)
+				for (x = bx * RANGE_DIM; x < xe; ++x)
+					dst[i + x] = lut[dst[i + x]];
+			else
+				for (x = bx * RANGE_DIM; x < xe; ++x)
+					dst[i + x] = lut[src[i + x]];
+		}
+	}
+	
+	return dst;
+}
+
 /* dump inv to point cloud (Stanford .ply) */
-int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int palette, float density)
+int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int palette, float density, const struct inv_mask *mask)
 {
 	FILE *fp;
 	uint16_t *pix16;
 	uint8_t *pix8;
 	int digits = 32;
-	int numv = 0;
+	size_t numv = 0;
 	int loops;
 	float x;
 	float y;
@@ -920,22 +5699,50 @@ int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int
 	int h;
 	int d;
 	int i;
+	int lo;
+	int hi;
 	bool is_adaptive = false;
+	bool *open = 0; // summary blocks with samples to emit (see OpenBlocks)
+	uint8_t *lut = 0; // 8-bit shade of every sample, for those blocks
+	const uint32_t *index = 0;
+	size_t indexNum = 0;
+	float *grid = 0; // per axis, each sample's coordinate, or -1 if skipped
 	
 	assert(inv);
 	assert(fn);
 	assert(density <= 1);
 	assert(minv >= 0 && minv <= 255);
 	assert(maxv >= 0 && maxv <= 255);
-	assert(inv->gray);
+	assert(GetStrip(inv) || inv->brick || inv->gray12 || inv->parent);
 	assert(inv->grayWidth);
 	assert(inv->grayHeight);
 	assert(inv->grayNum);
 	
+	/* the mask must cover the volume */
+	if (mask)
+	{
+		int mw;
+		int mh;
+		int md;
+		
+		inv_mask_get_dim(mask, &mw, &mh, &md);
+		if (mw != inv->grayWidth || mh != inv->grayHeight || md != (int)inv->grayNum)
+		{
+			fprintf(stderr, "mask dimensions differ from volume\n");
+			return -1;
+		}
+	}
+	
 	/* clear */
 	for (i = 0; i < 256; ++i)
 		ox[i] = oy[i] = oz[i] = -1;
 	
+	/* sample values that survive the 8-bit thresholds, for skipping
+	 * empty blocks; out-of-range samples are zeroed, so when zero
+	 * itself is in range, nothing can be skipped
+	 */
+	inv_get_shade_range(inv, minv, maxv, &lo, &hi);
+	
 	/* adaptive density */
 	if (density <= 0)
 	{
@@ -955,11 +5762,62 @@ int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int
 	 */
 	density = 1.0 / density;
 	
+	/* with an intensity index, only the samples in range are visited;
+	 * when minv is 0, every sample is written (out-of-range ones as 0)
+	 */
+	if (minv > 0 && !is_adaptive && !inv_index_range(inv, lo, hi, &index, &indexNum))
+	{
+		float *gx;
+		float *gy;
+		float *gz;
+		
+		if (!(grid = malloc((w + h + d) * sizeof(*grid))))
+		{
+			fprintf(stderr, "memory error\n");
+			return -1;
+		}
+		
+		/* the same stepping as the scan below */
+		gx = grid;
+		gy = gx + w;
+		gz = gy + h;
+		for (i = 0; i < w + h + d; ++i)
+			grid[i] = -1;
+		for (x = 0; x < w; x += density)
+			gx[(int)floor(x)] = x;
+		for (y = 0; y < h; y += density)
+			gy[(int)floor(y)] = y;
+		for (z = 0; z < d; z += density)
+			gz[(int)floor(z)] = z;
+	}
+	
+	/* otherwise, only the summary blocks that can hold samples in
+	 * range are converted and emitted, through a table of shades
+	 */
+	else if (minv > 0 && (open = OpenBlocks(inv, lo, hi)))
+	{
+		if (!(lut = malloc(UINT16_MAX + 1)))
+		{
+			fprintf(stderr, "memory error\n");
+			free(open);
+			return -1;
+		}
+		
+		if (inv->grayBps == 1)
+			for (i = 0; i < 256; ++i)
+				lut[i] = (i < minv || i > maxv) ? 0 : i;
+		else
+			inv_make_lut(lut, 0, 0, minv, maxv);
+	}
+	
 	/* temporary 16-bit pixel buffer */
-	pix16 = malloc(w * h * sizeof(*pix16));
+	pix16 = malloc((size_t)w * h * sizeof(*pix16));
 	if (!pix16)
 	{
 		fprintf(stderr, "memory error\n");
+		free(grid);
+		free(open);
+		free(lut);
 		return -1;
 	}
 	
@@ -968,6 +5826,10 @@ int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int
 	if (!fp)
 	{
 		fprintf(stderr, "failed to open '%s' for writing\n", fn);
+		free(grid);
+		free(open);
+		free(lut);
+		free(pix16);
 		return -1;
 	}
 	
@@ -986,7 +5848,7 @@ int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int
 		fprintf(fp,
 			"ply\n"
 			"format ascii 1.0\n"
-			"element vertex %*d\n"
+			"element vertex %*zu\n"
 			"property float x\n"
 			"property float y\n"
 			"property float z\n"
@@ -1003,26 +5865,83 @@ int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int
 		if (loops)
 			break;
 		
+		/* write vertex data, ordered by shade */
+		if (grid)
+		{
+			const float *gx = grid;
+			const float *gy = gx + w;
+			const float *gz = gy + h;
+			size_t k;
+			
+			for (k = 0; k < indexNum; ++k)
+			{
+				size_t pos = index[k];
+				int xi = pos % w;
+				int yi = pos / w % h;
+				int zi = pos / ((size_t)w * h);
+				int v = GetSample(inv, xi, yi, zi);
+				uint8_t rgb[3];
+				
+				if (gx[xi] < 0 || gy[yi] < 0 || gz[zi] < 0)
+					continue;
+				if (mask && !inv_mask_get(mask, xi, yi, zi))
+					continue;
+				
+				if (inv->grayBps != 1)
+					v = Shade8Default(v);
+				
+				rgb[0] = rgb[1] = rgb[2] = v;
+				if (palette >= 0)
+					palette_color(rgb, palette, v);
+				
+				fprintf(fp, "%f %f %f %d %d %d %d\n", gx[xi], gy[yi], gz[zi], rgb[0], rgb[1], rgb[2], v);
+				numv += 1;
+			}
+		}
+		
 		/* write vertex data, one image at a time */
-		for (z = 0; z < d; z += density)
+		else for (z = 0; z < d; z += density)
 		{
+			const bool *layer = 0;
+			
+			/* nothing in this slice can be emitted */
+			if (open && !(layer = LayerOpen(inv, open, (int)floor(z))))
+				continue;
+			if (mask && !inv_mask_count_slice(mask, (int)floor(z)))
+				continue;
+			
 			/* get pixels and convert to 8-bit (value range [0,255]) */
 			inv_get_plane(inv, pix16, (int)floor(z), INV_PLANE_AXIAL);
-			pix8 = inv_make_8bit(pix16, w, h, minv, maxv);
+			if (layer)
+				pix8 = ShadeOpenBlocks(inv, pix16, layer, lut);
+			else if (inv->grayBps == 1)
+				pix8 = inv_threshold_8bit(pix16, w, h, minv, maxv);
+			else
+				pix8 = inv_make_8bit(pix16, w, h, minv, maxv);
 			
 			/* for every pixel in image */
 			for (y = 0; y < h; y += density)
 			{
+				const bool *row = layer ? layer + ((int)floor(y) >> RANGE_SHIFT) * inv->rangeX : 0;
+				
 				for (x = 0; x < w; x += density)
 				{
 					int v = pix8[(int)floor(y) * w + (int)floor(x)];
 					uint8_t rgb[] = {v, v, v};
 					int a = v;
 					
+					/* skip blocks that were not converted */
+					if (row && !row[(int)floor(x) >> RANGE_SHIFT])
+						continue;
+					
 					/* skip pixels with values out of desired range */
 					if (v < minv || v > maxv)
 						continue;
 					
+					/* and those outside the mask */
+					if (mask && !inv_mask_get(mask, (int)floor(x), (int)floor(y), (int)floor(z)))
+						continue;
+					
 					/* experimenting with adaptive density */
 					if (is_adaptive)
 					{
@@ -1068,9 +5987,12 @@ int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int
 	}
 	
 	/* debug output */
-	fprintf(stderr, "wrote %d vertices\n", numv);
+	fprintf(stderr, "wrote %zu vertices\n", numv);
 	
 	/* cleanup */
+	free(grid);
+	free(open);
+	free(lut);
 	free(pix16);
 	fclose(fp);
 	
@@ -1078,6 +6000,16 @@ int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int
 	return 0;
 }
 
+/* returns the native-endian 16-bit image strip
+ * (0 for 8-bit volumes and volumes not stored slice-major)
+ */
+const uint16_t *inv_get_gray16(struct inv *inv)
+{
+	assert(inv);
+	
+	return inv->gray;
+}
+
 const void *inv_get_gray(struct inv *inv, int *w, int *h, int *num)
 {
 	assert(inv);
@@ -1089,7 +6021,7 @@ const void *inv_get_gray(struct inv *inv, int *w, int *h, int *num)
 	*h = inv->grayHeight;
 	*num = inv->grayNum;
 	
-	return inv->gray;
+	return GetStrip(inv);
 }
 
 /* prepares a base64 string with a length prefix prior to encoding */
@@ -1118,7 +6050,8 @@ static void PrefixedBase64(char *dst, const char *src)
 int inv_write(struct inv *inv, const char *outfn, const char *firstname, const char *lastname, const char *dob)
 {
 	FILE *fp;
-	const uint8_t *gray;
+	const uint16_t *gray;
+	uint16_t *frame;
 	int containerNum; // number of JPC containers
 	int i;
 	char PatientName[512]; // Last^First format
@@ -1139,6 +6072,13 @@ int inv_write(struct inv *inv, const char *outfn, const char *firstname, const c
 	assert(lastname);
 	assert(dob);
 	
+	/* the 16-bit samples are gone after an 8-bit load */
+	if (inv->grayBps != 2)
+	{
+		fprintf(stderr, "cannot write Invivo file from 8-bit volume\n");
+		return 1;
+	}
+	
 	/* prepare current date in YYYYMMDD format */
 	{
 		time_t t = time(0);
@@ -1171,7 +6111,12 @@ int inv_write(struct inv *inv, const char *outfn, const char *firstname, const c
 	}
 	
 	/* prepare these for later */
-	gray = inv->gray;
+	if (!(frame = malloc((size_t)inv->grayWidth * inv->grayHeight * sizeof(*frame))))
+	{
+		fprintf(stderr, "memory error\n");
+		fclose(fp);
+		return 1;
+	}
 	for (containerNum = 0; containerNum * inv->cmpno < (int)inv->grayNum; )
 		++containerNum;
 	cmpnoLast = inv->grayNum % inv->cmpno;
@@ -1245,6 +6190,8 @@ int inv_write(struct inv *inv, const char *outfn, const char *firstname, const c
 			int x;
 			int y;
 			
+			gray = GetAxial16(inv, inv->grayNum - imgrem, frame);
+			
 			for (y = 0; y < height; ++y)
 			{
 				for (x = 0; x < width; ++x)
@@ -1252,7 +6199,6 @@ int inv_write(struct inv *inv, const char *outfn, const char *firstname, const c
 					uint16_t v;
 					
 					v = *gray; gray++;
-					v |= *gray << 8; gray++;
 					
 					v += 0x8000;
 					
@@ -1289,6 +6235,7 @@ int inv_write(struct inv *inv, const char *outfn, const char *firstname, const c
 	
 	/* cleanup */
 	free(grayJPCsz);
+	free(frame);
 	fclose(fp);
 	
 	/* success */
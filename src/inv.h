@@ -2,8 +2,29 @@
 #define INV_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct inv;
+struct inv_mask; // see mask.h
+
+/* optional load settings; pass 0 (or a zeroed struct) for the defaults */
+struct inv_opts
+{
+	bool isThreaded; // enables multithreaded decoding (if available)
+	bool is8bit; // convert to 8-bit while decoding (1 byte per sample)
+	bool hasHugePages; // voxel strip on transparent huge pages, placed by first touch
+	bool isInterleaved; // voxel strip interleaved across NUMA nodes (implies hasHugePages)
+	int windowCenter; // 8-bit window, in 16-bit sample units;
+	int windowWidth; // windowWidth <= 0 uses inv_make_8bit's mapping
+	int brickDim; // stores samples in brickDim^3 blocks (0 = slice-major)
+	bool isCompressed; // keeps bricks losslessly compressed (16^3 if no brickDim)
+	bool is12bit; // stores 16-bit samples in 12 bits, when that is lossless
+	int residentLimit; // out-of-core: bricks live on disk, at most this many MiB in memory
+	bool hasPlaneCopies; // also keep sagittal- and coronal-major copies
+	bool hasPyramid; // also keep 2x, 4x, and 8x downscaled copies
+	bool hasSums; // also keep a summed-volume table, for inv_box_stats
+	bool hasIndex; // also keep sample positions sorted by value, for inv_index_range
+};
 
 enum inv_plane
 { // directions are from the skull's point of view
@@ -13,18 +34,63 @@ enum inv_plane
 	, INV_PLANE_NUM       // num planes in this enum
 };
 
+enum inv_slab
+{ // thick-slab projections (see inv_get_slab)
+	INV_SLAB_MAX = 0 // maximum intensity (MIP)
+	, INV_SLAB_MIN   // minimum intensity (MinIP)
+	, INV_SLAB_AVG   // average intensity
+	, INV_SLAB_NUM   // num modes in this enum
+};
+
+/* receives plane 'image' of a batch (see inv_get_planes); non-zero stops the batch */
+typedef int inv_plane_func(void *udata, const void *pixels, int image, int w, int h);
+
 void *inv_make_8bit(void *pixels16bit, int w, int h, int threshold_min, int threshold_max);
+void *inv_threshold_8bit(void *pixels8bit, int w, int h, int threshold_min, int threshold_max);
+void inv_make_lut(uint8_t *lut, int window_center, int window_width, int threshold_min, int threshold_max);
+void *inv_apply_lut(void *pixels16bit, int w, int h, const uint8_t *lut);
+int inv_get_bytes_per_sample(struct inv *inv);
 int inv_get_width(struct inv *inv);
 int inv_get_height(struct inv *inv);
 int inv_get_num_images(struct inv *inv);
 const void *inv_get_plane(struct inv *inv, void *dst, int image, enum inv_plane plane);
+int inv_get_planes(struct inv *inv, int first, int num, enum inv_plane plane, inv_plane_func *func, void *udata);
+const void *inv_get_oblique(struct inv *inv, void *dst, const float origin[3], const float u[3], const float v[3], int w, int h);
+const void *inv_get_slab(struct inv *inv, void *dst, int image, int thickness, enum inv_plane plane, enum inv_slab mode);
+float inv_arch_length(const float *curve, int num);
+int inv_estimate_arch(struct inv *inv, int image, int thickness, float *curve, int num);
+const void *inv_get_panoramic(struct inv *inv, void *dst, const float *curve, int num, int thickness, int w, int h);
+const void *inv_get_cross_section(struct inv *inv, void *dst, const float *curve, int num, float at, int w, int h);
+struct inv *inv_view(struct inv *parent, int x, int y, int z, int w, int h, int d);
+struct inv *inv_snapshot(struct inv *inv);
+void inv_get_brick_grid(struct inv *inv, int *dim, int *nx, int *ny, int *nz);
+bool inv_is_thread_safe(struct inv *inv);
+uint16_t *inv_edit_brick(struct inv *inv, int bx, int by, int bz);
+int inv_set_sample16(struct inv *inv, int x, int y, int z, uint16_t v);
+void inv_get_plane_dim(struct inv *inv, enum inv_plane plane, int *w, int *h);
+const void *inv_get_plane_ptr(struct inv *inv, int image, enum inv_plane plane);
+const void *inv_get_plane_scaled(struct inv *inv, void *dst, int image, enum inv_plane plane, int maxW, int maxH, int *w, int *h);
 const void *inv_get_gray(struct inv *inv, int *w, int *h, int *num);
+const uint16_t *inv_get_gray16(struct inv *inv);
+const uint16_t *inv_get_frame16(struct inv *inv, int image);
+uint16_t inv_get_sample16(struct inv *inv, int x, int y, int z);
+uint8_t inv_get_sample8(struct inv *inv, int x, int y, int z);
+void inv_get_range_grid(struct inv *inv, int *dim, int *nx, int *ny, int *nz);
+void inv_get_range(struct inv *inv, int bx, int by, int bz, int *min, int *max);
+bool inv_range_overlaps(struct inv *inv, int bx, int by, int bz, int lo, int hi);
+void inv_update_ranges(struct inv *inv, int x0, int y0, int z0, int x1, int y1, int z1);
+size_t inv_count_in_range(struct inv *inv, int lo, int hi);
+int inv_get_shade_range(struct inv *inv, int minv, int maxv, int *lo, int *hi);
+int inv_auto_window(struct inv *inv, float low_percent, float high_percent, int *window_center, int *window_width);
+struct inv_mask *inv_threshold_mask(struct inv *inv, int lo, int hi);
+int inv_index_range(struct inv *inv, int lo, int hi, const uint32_t **pos, size_t *num);
+int inv_box_stats(struct inv *inv, int x0, int y0, int z0, int x1, int y1, int z1, size_t *count, double *mean, double *variance);
 int inv_dump(struct inv *inv, const char *fn);
-int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int palette, float density);
-struct inv *inv_parse(const void *src, size_t srcSz, bool isThreaded);
-struct inv *inv_load(const char *fn, bool isThreaded);
-struct inv *inv_load_binary(const char *fn, int w, int h);
-struct inv *inv_load_series(const char *pattern, int start, int end);
+int inv_dump_pointcloud(struct inv *inv, const char *fn, int minv, int maxv, int palette, float density, const struct inv_mask *mask);
+struct inv *inv_parse(const void *src, size_t srcSz, const struct inv_opts *opts);
+struct inv *inv_load(const char *fn, const struct inv_opts *opts);
+struct inv *inv_load_binary(const char *fn, int w, int h, const struct inv_opts *opts);
+struct inv *inv_load_series(const char *pattern, int start, int end, const struct inv_opts *opts);
 void inv_free(struct inv *inv);
 int inv_write(struct inv *inv, const char *outfn, const char *firstname, const char *lastname, const char *dob);
 const char *inv_get_patient_name(struct inv *inv);
@@ -7,10 +7,29 @@
 #include "inv.h"
 #include "viewer.h"
 #include "palette.h"
+#include "bench.h"
+#include "check.h"
+#include "mask.h"
+#include "render.h"
+#include <stb_image_write.h>
 
 /* XXX this was added only for creating animated GIFs */
 int global_image_index = 0;
 
+/* most points in a dental arch curve, and how many an estimate uses */
+#define ARCH_MAX 32
+#define ARCH_ESTIMATED 9
+
+/* --drr puts its point source this many times the volume's largest
+ * dimension from the volume's center (about a cephalostat's 1.5 m to
+ * the midsagittal plane, for a 15 cm field of view)
+ */
+#define DRR_DISTANCE 10
+
+/* the viewer's automatic window spans these percentiles of the histogram */
+#define AUTO_WINDOW_LOW 0.5f
+#define AUTO_WINDOW_HIGH 99.5f
+
 static int max2(int a, int b)
 {
 	return a > b ? a : b;
@@ -21,6 +40,68 @@ static int max3(int a, int b, int c)
 	return max2(max2(a, b), c);
 }
 
+/* inv_get_planes callback for the valgrind test: copies each plane into udata */
+struct plane_copy
+{
+	void *dst;
+	int bps;
+};
+
+static int copy_plane(void *udata, const void *pixels, int image, int w, int h)
+{
+	struct plane_copy *copy = udata;
+	
+	(void)image;
+	
+	memcpy(copy->dst, pixels, (size_t)w * h * copy->bps);
+	
+	return 0;
+}
+
+/* converts a plane to 8-bit for the viewer: 16-bit samples through its
+ * window's shade table, 8-bit ones (windowed as they loaded) through
+ * the thresholds alone
+ */
+static void shade_plane(struct inv *inv, void *pix, int w, int h, const uint8_t *lut, int threshold_min, int threshold_max)
+{
+	if (inv_get_bytes_per_sample(inv) == 1)
+		inv_threshold_8bit(pix, w, h, threshold_min, threshold_max);
+	else
+		inv_apply_lut(pix, w, h, lut);
+}
+
+/* renders a digitally reconstructed radiograph to a size*size .png */
+static int write_drr(struct inv *inv, const char *fn, enum inv_drr_view view, int size, int minv, int maxv, bool isThreaded)
+{
+	struct inv_render *r;
+	uint8_t *gray;
+	int big = max3(inv_get_width(inv), inv_get_height(inv), inv_get_num_images(inv));
+	int rval = 1;
+	
+	if (!(r = inv_render_new(inv, isThreaded)))
+		return 1;
+	if (!(gray = malloc((size_t)size * size)))
+	{
+		fprintf(stderr, "memory error\n");
+		goto L_cleanup;
+	}
+	if (inv_render_set_shading(r, minv, maxv, -1)
+		|| inv_render_drr(r, gray, size, size, view, (float)big * DRR_DISTANCE)
+	)
+		goto L_cleanup;
+	if (!stbi_write_png(fn, size, size, 1, gray, size))
+	{
+		fprintf(stderr, "failed to write '%s'\n", fn);
+		goto L_cleanup;
+	}
+	
+	rval = 0;
+L_cleanup:
+	free(gray);
+	inv_render_free(r);
+	return rval;
+}
+
 /* convert yyyymmdd -> yyyy/mm/dd format */
 static const char *formatdate(const char *yyyymmdd)
 {
@@ -44,26 +125,43 @@ int main(int argc, char *argv[])
 	const char *progname = argv[0];
 	const char *fn = argv[argc - 1];
 	const char *dump = 0;
-	const char *points = 0;
+	struct
+	{
+		const char *fn;
+		int minv;
+		int maxv;
+		int palette;
+		float density;
+	} points[16]; // each --points
+	int points_num = 0;
 	const char *invivo = 0;
 	char invivo_first[256] = {0};
 	char invivo_last[256] = {0};
 	char invivo_dob[256] = {0};
+	const char *drr = 0;
+	enum inv_drr_view drr_view = INV_DRR_LATERAL;
+	int drr_size = 0;
+	int drr_minv = 0;
+	int drr_maxv = 255;
 	struct inv *inv;
+	struct inv *whole = 0; // the loaded volume, when inv is a --crop view of it
+	struct inv_opts opts = {0};
 	bool isBinary = false;
 	bool isSeries = false;
-	bool isThreaded = false;
 	bool showViewer = false;
+	bool runBenchmark = false;
+	bool runCheckLarge = false;
+	bool isCropped = false;
+	int crop[6]; // x,y,z,w,h,d
+	struct inv_mask *mask = 0;
+	int mask_range[16][2]; // min,max shades of each --mask
+	int mask_num = 0;
 	int series_low;
 	int series_high;
 	int viewer_width;
 	int viewer_height;
 	int width;
 	int height;
-	int points_minv = 0;
-	int points_maxv = 0;
-	float points_density = 0;
-	int points_palette = -1;
 	int i;
 	
 	/* show arguments */
@@ -74,6 +172,73 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "  optional arguments (these are the --options):\n");
 		fprintf(stderr, "    --threads\n");
 		fprintf(stderr, "        * enables multithreading (if available)\n");
+		fprintf(stderr, "    --huge-pages\n");
+		fprintf(stderr, "        * puts the voxel data on transparent huge pages,\n");
+		fprintf(stderr, "          each page first written by the thread decoding it\n");
+		fprintf(stderr, "          (Linux only; best combined with --threads)\n");
+		fprintf(stderr, "    --interleave\n");
+		fprintf(stderr, "        * like --huge-pages, but spreads the voxel data evenly\n");
+		fprintf(stderr, "          across NUMA nodes (for multi-socket machines)\n");
+		fprintf(stderr, "    --8bit    center,width\n");
+		fprintf(stderr, "        * converts samples to 8-bit while loading,\n");
+		fprintf(stderr, "          halving memory use (for viewing/exporting only)\n");
+		fprintf(stderr, "        * center,width is a window in 16-bit sample units;\n");
+		fprintf(stderr, "          'default' uses the viewer's usual mapping\n");
+		fprintf(stderr, "        * e.g. --8bit default\n");
+		fprintf(stderr, "        * e.g. --8bit 34000,6000\n");
+		fprintf(stderr, "    --12bit\n");
+		fprintf(stderr, "        * stores samples in 12 bits instead of 16 (-25%% memory)\n");
+		fprintf(stderr, "          when the scanner produced no more than 12 bits;\n");
+		fprintf(stderr, "          otherwise the volume stays 16-bit (lossless)\n");
+		fprintf(stderr, "    --bricks  size\n");
+		fprintf(stderr, "        * stores the volume in size^3 blocks instead of\n");
+		fprintf(stderr, "          slice by slice, which speeds up sagittal and\n");
+		fprintf(stderr, "          coronal reslicing\n");
+		fprintf(stderr, "        * size must be a power of two (16 or 32 work well)\n");
+		fprintf(stderr, "        * e.g. --bricks 32\n");
+		fprintf(stderr, "    --compress\n");
+		fprintf(stderr, "        * keeps the bricks losslessly compressed in memory,\n");
+		fprintf(stderr, "          decoding them on demand (implies --bricks 16\n");
+		fprintf(stderr, "          unless another size is given)\n");
+		fprintf(stderr, "    --out-of-core  MiB\n");
+		fprintf(stderr, "        * for volumes larger than memory: streams the volume\n");
+		fprintf(stderr, "          into a temporary on-disk brick store while loading,\n");
+		fprintf(stderr, "          keeping at most MiB of bricks in memory\n");
+		fprintf(stderr, "          (implies --bricks 16 unless another size is given)\n");
+		fprintf(stderr, "        * e.g. --out-of-core 512\n");
+		fprintf(stderr, "    --plane-copies\n");
+		fprintf(stderr, "        * keeps sagittal- and coronal-major copies of the volume,\n");
+		fprintf(stderr, "          so every plane is a contiguous copy (triples memory use)\n");
+		fprintf(stderr, "    --pyramid\n");
+		fprintf(stderr, "        * keeps 2x, 4x, and 8x downscaled copies of the volume\n");
+		fprintf(stderr, "          (+15%% memory) so the viewer can show small quadrants\n");
+		fprintf(stderr, "          without reslicing at full resolution\n");
+		fprintf(stderr, "    --box-stats\n");
+		fprintf(stderr, "        * keeps a summed-volume table (8x the memory of a\n");
+		fprintf(stderr, "          16-bit volume) for constant time box statistics\n");
+		fprintf(stderr, "    --index\n");
+		fprintf(stderr, "        * keeps every sample's position sorted by value\n");
+		fprintf(stderr, "          (+4 bytes per sample), so each --points with\n");
+		fprintf(stderr, "          min > 0 visits only the samples it writes\n");
+		fprintf(stderr, "    --crop    x,y,z,w,h,d\n");
+		fprintf(stderr, "        * works on the w*h*d box at x,y,z instead of the\n");
+		fprintf(stderr, "          whole volume (for every output and the viewer),\n");
+		fprintf(stderr, "          without copying it\n");
+		fprintf(stderr, "        * e.g. --crop 100,200,0,336,200,220\n");
+		fprintf(stderr, "    --mask    min,max\n");
+		fprintf(stderr, "        * restricts --points to the samples w/ shades in\n");
+		fprintf(stderr, "          value range [min,max] (in the range [0,255]),\n");
+		fprintf(stderr, "          kept as a 1-bit mask; repeat to add more ranges\n");
+		fprintf(stderr, "        * e.g. --mask 20,60 --mask 200,255\n");
+		fprintf(stderr, "    --benchmark\n");
+		fprintf(stderr, "        * times common operations on the loaded volume\n");
+		fprintf(stderr, "    --check-large\n");
+		fprintf(stderr, "        * instead of loading the input file, writes a synthetic\n");
+		fprintf(stderr, "          2048x1024x1040 volume (4.06 GiB) there, loads it with\n");
+		fprintf(stderr, "          the other --options, and checks reslicing, --dump,\n");
+		fprintf(stderr, "          and --points against it (then deletes it)\n");
+		fprintf(stderr, "        * the input file (and its .dump and .ply) must not exist yet\n");
+		fprintf(stderr, "        * e.g. --check-large --out-of-core 512 big.bin\n");
 		fprintf(stderr, "    --viewer width,height\n");
 		fprintf(stderr, "        * opens viewer window after loading data\n");
 		fprintf(stderr, "        * width,height are window dimensions\n");
@@ -96,6 +261,7 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "        * specifies output binary file to create;\n");
 		fprintf(stderr, "        * the file will contain a series of raw images\n");
 		fprintf(stderr, "          stored in 16-bit unsigned little-endian format\n");
+		fprintf(stderr, "          (or 8-bit, if loaded with --8bit)\n");
 		fprintf(stderr, "    --points  out.ply min,max,palette,density\n");
 		fprintf(stderr, "        * specifies output point cloud file to create;\n");
 		fprintf(stderr, "        * the file will be a Stanford .ply containing a series\n");
@@ -110,6 +276,15 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "          where brighter pixel clusters are assumed to be denser\n");
 		fprintf(stderr, "          (XXX adaptive density is experimental; don't use it)\n");
 		fprintf(stderr, "        * e.g. --points out.ply 20,255,None,0.25\n");
+		fprintf(stderr, "        * may be repeated, e.g. to try several thresholds\n");
+		fprintf(stderr, "    --drr     out.png view,size,min,max\n");
+		fprintf(stderr, "        * writes a size*size digitally reconstructed radiograph\n");
+		fprintf(stderr, "          (a simulated cephalogram) as a grayscale .png\n");
+		fprintf(stderr, "        * view is 'lateral' (from the right, face to the right)\n");
+		fprintf(stderr, "          or 'pa' (posteroanterior, from behind)\n");
+		fprintf(stderr, "        * only shades in value range [min,max] absorb, as with\n");
+		fprintf(stderr, "          --points (optional; defaults to 0,255)\n");
+		fprintf(stderr, "        * e.g. --drr ceph.png lateral,1024\n");
 		return -1;
 	}
 	
@@ -137,7 +312,116 @@ int main(int argc, char *argv[])
 		}
 		else if (!strcmp(this, "threads"))
 		{
-			isThreaded = true;
+			opts.isThreaded = true;
+		}
+		else if (!strcmp(this, "huge-pages"))
+		{
+			opts.hasHugePages = true;
+		}
+		else if (!strcmp(this, "interleave"))
+		{
+			opts.isInterleaved = true;
+		}
+		else if (!strcmp(this, "benchmark"))
+		{
+			runBenchmark = true;
+		}
+		else if (!strcmp(this, "check-large"))
+		{
+			runCheckLarge = true;
+		}
+		else if (!strcmp(this, "pyramid"))
+		{
+			opts.hasPyramid = true;
+		}
+		else if (!strcmp(this, "compress"))
+		{
+			opts.isCompressed = true;
+		}
+		else if (!strcmp(this, "index"))
+		{
+			opts.hasIndex = true;
+		}
+		else if (!strcmp(this, "12bit"))
+		{
+			opts.is12bit = true;
+		}
+		else if (!strcmp(this, "box-stats"))
+		{
+			opts.hasSums = true;
+		}
+		else if (!strcmp(this, "plane-copies"))
+		{
+			opts.hasPlaneCopies = true;
+		}
+		else if (!strcmp(this, "bricks"))
+		{
+			if (sscanf(next, "%d", &opts.brickDim) != 1 || opts.brickDim <= 0)
+			{
+				fprintf(stderr, "argument '%s %s' malformatted\n", this, next);
+				return -1;
+			}
+			
+			i += 1;
+		}
+		else if (!strcmp(this, "crop"))
+		{
+			if (sscanf(next, "%d,%d,%d,%d,%d,%d", &crop[0], &crop[1], &crop[2], &crop[3], &crop[4], &crop[5]) != 6)
+			{
+				fprintf(stderr, "argument '%s %s' malformatted\n", this, next);
+				return -1;
+			}
+			
+			isCropped = true;
+			
+			i += 1;
+		}
+		else if (!strcmp(this, "mask"))
+		{
+			int *r = mask_range[mask_num];
+			
+			if (mask_num == sizeof(mask_range) / sizeof(*mask_range))
+			{
+				fprintf(stderr, "too many --mask arguments\n");
+				return -1;
+			}
+			
+			if (sscanf(next, "%d,%d", &r[0], &r[1]) != 2
+				|| r[0] < 0 || r[0] > 255 || r[1] < 0 || r[1] > 255
+			)
+			{
+				fprintf(stderr, "argument '%s %s' malformatted\n", this, next);
+				return -1;
+			}
+			
+			mask_num += 1;
+			i += 1;
+		}
+		else if (!strcmp(this, "out-of-core"))
+		{
+			if (sscanf(next, "%d", &opts.residentLimit) != 1 || opts.residentLimit <= 0)
+			{
+				fprintf(stderr, "argument '%s %s' malformatted\n", this, next);
+				return -1;
+			}
+			
+			i += 1;
+		}
+		else if (!strcmp(this, "8bit"))
+		{
+			if (strcmp(next, "default")
+				&& (sscanf(next, "%d,%d", &opts.windowCenter, &opts.windowWidth) != 2
+					|| opts.windowWidth <= 0
+				)
+			)
+			{
+				fprintf(stderr, "argument '%s %s' malformatted\n", this, next);
+				return -1;
+			}
+			
+			opts.is8bit = true;
+			
+			i += 1;
 		}
 		else if (!strcmp(this, "viewer"))
 		{
@@ -169,6 +453,35 @@ int main(int argc, char *argv[])
 			
 			i += 1;
 		}
+		else if (!strcmp(this, "drr"))
+		{
+			const char *extra = argv[i + 2];
+			char viewname[256] = {0};
+			int got;
+			
+			drr = next;
+			
+			got = sscanf(extra, "%255[^,],%d,%d,%d", viewname, &drr_size, &drr_minv, &drr_maxv);
+			if (got < 2 || got == 3
+				|| drr_size <= 0 || drr_size > 16384
+				|| drr_minv < 0 || drr_minv > drr_maxv || drr_maxv > 255
+			)
+			{
+				fprintf(stderr, "argument '%s %s %s' malformatted\n", this, next, extra);
+				return -1;
+			}
+			if (!strcmp(viewname, "lateral"))
+				drr_view = INV_DRR_LATERAL;
+			else if (!strcmp(viewname, "pa"))
+				drr_view = INV_DRR_PA;
+			else
+			{
+				fprintf(stderr, "unknown --drr view '%s'\n", viewname);
+				return -1;
+			}
+			
+			i += 2;
+		}
 		else if (!strcmp(this, "invivo"))
 		{
 			const char *extra = argv[i + 2];
@@ -196,8 +509,16 @@ int main(int argc, char *argv[])
 			char palname[1024];
 			const char *extra = argv[i + 2];
 			int got;
+			int points_minv = 0;
+			int points_maxv = 0;
+			float points_density = 0;
+			int points_palette = -1;
 			
-			points = next;
+			if (points_num == sizeof(points) / sizeof(*points))
+			{
+				fprintf(stderr, "too many --points arguments\n");
+				return -1;
+			}
 			
 			got = sscanf(extra, "%d,%d,%[^,],%f", &points_minv, &points_maxv, palname, &points_density);
 			
@@ -235,6 +556,13 @@ int main(int argc, char *argv[])
 				goto L_points_fail;
 			}
 			
+			points[points_num].fn = next;
+			points[points_num].minv = points_minv;
+			points[points_num].maxv = points_maxv;
+			points[points_num].palette = points_palette;
+			points[points_num].density = points_density;
+			points_num += 1;
+			
 			i += 2;
 		}
 		else
@@ -251,35 +579,78 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 	
+	/* 64-bit self-check, on a volume of its own */
+	if (runCheckLarge)
+		return check_large(fn, &opts) ? -1 : 0;
+	
 	/* load inv file */
 	if (isBinary)
 	{
-		if (!(inv = inv_load_binary(fn, width, height)))
+		if (!(inv = inv_load_binary(fn, width, height, &opts)))
 			return -1;
 	}
 	else if (isSeries)
 	{
-		if (!(inv = inv_load_series(fn, series_low, series_high)))
+		if (!(inv = inv_load_series(fn, series_low, series_high, &opts)))
 			return -1;
 	}
 	else
 	{
-		if (!(inv = inv_load(fn, isThreaded)))
+		if (!(inv = inv_load(fn, &opts)))
+			return -1;
+	}
+	
+	/* everything below operates on the view */
+	if (isCropped)
+	{
+		whole = inv;
+		if (!(inv = inv_view(whole, crop[0], crop[1], crop[2], crop[3], crop[4], crop[5])))
 			return -1;
 	}
 	
+	/* union of every --mask range */
+	for (i = 0; i < mask_num; ++i)
+	{
+		struct inv_mask *next;
+		int lo;
+		int hi;
+		
+		inv_get_shade_range(inv, mask_range[i][0], mask_range[i][1], &lo, &hi);
+		if (!(next = inv_threshold_mask(inv, lo, hi)))
+			return -1;
+		
+		if (!mask)
+			mask = next;
+		else
+		{
+			inv_mask_or(mask, next);
+			inv_mask_free(next);
+		}
+	}
+	if (mask)
+		fprintf(stdout, "mask holds %zu samples\n", inv_mask_count(mask));
+	
+	/* benchmarks */
+	if (runBenchmark)
+		bench_run(inv);
+	
 	/* dump inv file to raw 16-bit image strip */
 	if (dump && inv_dump(inv, dump))
 		return -1;
 	
-	/* dump inv file to point cloud */
-	if (points && inv_dump_pointcloud(inv, points, points_minv, points_maxv, points_palette, points_density))
-		return -1;
+	/* dump inv file to point clouds */
+	for (i = 0; i < points_num; ++i)
+		if (inv_dump_pointcloud(inv, points[i].fn, points[i].minv, points[i].maxv, points[i].palette, points[i].density, mask))
+			return -1;
 	
 	/* write Invivo .inv file */
 	if (invivo && inv_write(inv, invivo, invivo_first, invivo_last, invivo_dob))
 		return -1;
 	
+	/* write digitally reconstructed radiograph */
+	if (drr && write_drr(inv, drr, drr_view, drr_size, drr_minv, drr_maxv, opts.isThreaded))
+		return -1;
+	
 	/* viewer */
 	if (showViewer)
 	{
@@ -294,11 +665,40 @@ int main(int argc, char *argv[])
 		float where_percent[] = { 0, 0, 0 };
 		int is_animated[] = { 0, 0, 0 };
 		int palette = -1;
-		uint16_t *pix = calloc(big * big, sizeof(*pix));
+		uint16_t *pix = calloc((size_t)big * big, sizeof(*pix));
 		bool show_axis_guides = false;
+		bool show_oblique = false;
+		bool oblique_dirty = false;
+		float oblique_tilt[2] = { 0, 0 }; // about the x and y axes, in radians
+		int slab_mode = -1; // enum inv_slab, or -1 for single slices
+		int slab_thickness = 30;
+		struct inv_render *render = 0;
+		uint8_t *rgb = 0;
+		bool show_render = false;
+		bool render_dirty = false;
+		bool render_is_coarse = false;
+		int render_mode = INV_RENDER_MIP;
+		float render_yaw = 0;
+		float render_pitch = 0;
+		bool show_panoramic = false;
+		bool panoramic_dirty = false;
+		int panoramic_thickness = 10;
+		float panoramic_at = 0.5f; // the cross-section's position along the arch
+		float arch[ARCH_MAX * 2]; // dental arch curve, in axial voxels
+		float arch_percent[ARCH_MAX * 2]; // the same, as fractions of the axial plane
+		int arch_num = 0;
 		int threshold_min = 0;
 		int threshold_max = 255;
+		int window_center = 32768; // in sample units
+		int window_width = 0; // 0 = inv_make_8bit's mapping
+		uint8_t *lut = malloc(65536); // 16-bit sample -> shade, through the window and thresholds
+		bool lut_dirty = true;
 		
+		if (!lut)
+		{
+			fprintf(stderr, "memory error\n");
+			return -1;
+		}
 		if (!(viewer = viewer_create(w, h, num, viewer_width, viewer_height)))
 			return -1;
 		for (;;)
@@ -311,6 +711,16 @@ int main(int argc, char *argv[])
 			
 			viewer_clear(viewer);
 			
+			/* window or threshold changes rebuild only the shade table, then redraw */
+			if (lut_dirty)
+			{
+				inv_make_lut(lut, window_center, window_width, threshold_min, threshold_max);
+				for (i = 0; i < INV_PLANE_NUM; ++i)
+					where_last[i] = -1;
+				render_dirty = true;
+				lut_dirty = false;
+			}
+			
 			for (i = 0; i < INV_PLANE_NUM; ++i)
 			{
 				int w;
@@ -344,17 +754,173 @@ int main(int argc, char *argv[])
 					continue;
 				where_last[i] = where[i];
 				
+				/* the oblique plane passes through every plane's position */
+				oblique_dirty = true;
+				if (i == INV_PLANE_AXIAL && show_oblique)
+					continue;
+				
+				/* the panoramic view and cross-section stand in for the other planes */
+				if (i != INV_PLANE_AXIAL && show_panoramic)
+				{
+					panoramic_dirty = true;
+					continue;
+				}
+				
 				/* write every nth frame */
 				global_image_index = !(where[i] % 7) ? where[i] : -1;
 				
-				viewer_get_dim(viewer, i, &w, &h);
-				inv_get_plane(inv, pix, where[i], i);
-				inv_make_8bit(pix, w, h, threshold_min, threshold_max);
+				/* thick slab, or a quadrant-sized plane from the pyramid if there is one */
+				if (slab_mode >= 0 && inv_get_slab(inv, pix, where[i], slab_thickness, i, slab_mode))
+					inv_get_plane_dim(inv, i, &w, &h);
+				else
+				{
+					viewer_get_quadrant_dim(viewer, &w, &h);
+					inv_get_plane_scaled(inv, pix, where[i], i, w, h, &w, &h);
+				}
+				shade_plane(inv, pix, w, h, lut, threshold_min, threshold_max);
 				viewer_upload_pixels(viewer, pix, w, h, i);
 			}
 			
+			/* oblique plane in place of the axial one, tilted by dragging */
+			if (show_oblique)
+			{
+				int dx;
+				int dy;
+				
+				if (viewer_get_mouse_drag_in_quadrant(viewer, INV_PLANE_AXIAL, &dx, &dy) && (dx || dy))
+				{
+					oblique_tilt[0] += dy * 0.01f;
+					oblique_tilt[1] += dx * 0.01f;
+					oblique_dirty = true;
+				}
+				
+				if (oblique_dirty)
+				{
+					float center[3] = { where[INV_PLANE_SAGITTAL], where[INV_PLANE_CORONAL], where[INV_PLANE_AXIAL] };
+					float sp = sinf(oblique_tilt[0]);
+					float cp = cosf(oblique_tilt[0]);
+					float sq = sinf(oblique_tilt[1]);
+					float cq = cosf(oblique_tilt[1]);
+					float u[3] = { cq, 0, -sq };
+					float v[3] = { sp * sq, cp, sp * cq };
+					float origin[3];
+					float step;
+					int w;
+					int h;
+					int n;
+					
+					/* square, spanning the largest dimension */
+					viewer_get_quadrant_dim(viewer, &w, &h);
+					n = w < h ? w : h;
+					if (n > big)
+						n = big;
+					step = (float)big / n;
+					for (i = 0; i < 3; ++i)
+					{
+						u[i] *= step;
+						v[i] *= step;
+						origin[i] = center[i] - (u[i] + v[i]) * n * 0.5f;
+					}
+					
+					inv_get_oblique(inv, pix, origin, u, v, n, n);
+					shade_plane(inv, pix, n, n, lut, threshold_min, threshold_max);
+					viewer_upload_pixels(viewer, pix, n, n, INV_PLANE_AXIAL);
+					oblique_dirty = false;
+				}
+			}
+			
+			/* panoramic view along a dental arch in place of the sagittal plane,
+			 * and a cross-section of it in place of the coronal plane
+			 */
+			if (show_panoramic)
+			{
+				float fx;
+				float fy;
+				
+				/* clicks on the axial plane add arch points; on the panorama, pick the cross-section */
+				if (!show_oblique && arch_num < ARCH_MAX
+					&& viewer_get_mouse_click_in_quadrant(viewer, INV_PLANE_AXIAL, &fx, &fy)
+				)
+				{
+					arch[arch_num * 2] = fx * w;
+					arch[arch_num * 2 + 1] = fy * h;
+					arch_num += 1;
+					panoramic_dirty = true;
+				}
+				if (viewer_get_mouse_click_in_quadrant(viewer, INV_PLANE_SAGITTAL, &fx, &fy))
+				{
+					panoramic_at = fx;
+					panoramic_dirty = true;
+				}
+				
+				if (panoramic_dirty && arch_num >= 2)
+				{
+					int pw = ceilf(inv_arch_length(arch, arch_num));
+					int cw = num / 2 + 1;
+					
+					/* one column per voxel along the arch, as long as pix has room */
+					if (pw < 1)
+						pw = 1;
+					else if (pw > big)
+						pw = big;
+					
+					if (inv_get_panoramic(inv, pix, arch, arch_num, panoramic_thickness, pw, num))
+					{
+						shade_plane(inv, pix, pw, num, lut, threshold_min, threshold_max);
+						viewer_upload_pixels(viewer, pix, pw, num, INV_PLANE_SAGITTAL);
+					}
+					if (inv_get_cross_section(inv, pix, arch, arch_num, panoramic_at, cw, num))
+					{
+						shade_plane(inv, pix, cw, num, lut, threshold_min, threshold_max);
+						viewer_upload_pixels(viewer, pix, cw, num, INV_PLANE_CORONAL);
+					}
+				}
+				panoramic_dirty = false;
+				
+				for (i = 0; i < arch_num; ++i)
+				{
+					arch_percent[i * 2] = arch[i * 2] / w;
+					arch_percent[i * 2 + 1] = arch[i * 2 + 1] / h;
+				}
+			}
+			viewer_set_curve(viewer, arch_percent, show_panoramic && !show_oblique ? arch_num : 0);
+			
+			/* volume rendering in the fourth quadrant; coarse while dragging, refined once idle */
+			if (show_render)
+			{
+				int dx;
+				int dy;
+				bool is_dragging = viewer_get_mouse_drag_in_quadrant(viewer, INV_PLANE_NUM, &dx, &dy);
+				
+				if (is_dragging && (dx || dy))
+				{
+					render_yaw += dx * 0.01f;
+					render_pitch += dy * 0.01f;
+					render_dirty = true;
+				}
+				
+				if (render_dirty || (render_is_coarse && !is_dragging))
+				{
+					int w;
+					int h;
+					
+					viewer_get_quadrant_dim(viewer, &w, &h);
+					render_is_coarse = is_dragging;
+					if (render_is_coarse)
+						w /= 4, h /= 4;
+					
+					inv_render_set_window(render, window_center, window_width);
+					if (!inv_render_set_shading(render, threshold_min, threshold_max, palette))
+					{
+						inv_render_draw(render, rgb, w, h, render_yaw, render_pitch, render_mode);
+						viewer_upload_rgb(viewer, rgb, w, h, INV_PLANE_NUM);
+					}
+					render_dirty = false;
+				}
+			}
+			
 			/* update axis guides */
-			viewer_set_axes(viewer, show_axis_guides, where_percent);
+			viewer_set_axes(viewer, show_axis_guides && !show_panoramic, where_percent);
 			
 			/* draw quadrants and process axis guide changes */
 			{
@@ -384,9 +950,19 @@ int main(int argc, char *argv[])
 				int y;
 				int h;
 				int pad = 2;
+				const char *name = plane_name[i];
+				
+				if (i == INV_PLANE_AXIAL && show_oblique)
+					name = "Oblique";
+				else if (i == INV_PLANE_SAGITTAL && show_panoramic)
+					name = "Panoramic";
+				else if (i == INV_PLANE_CORONAL && show_panoramic)
+					name = "Cross-section";
+				else if (i == INV_PLANE_NUM && show_render)
+					name = "3D View";
 				
 				viewer_get_quadrant(viewer, i % 2, i / 2, &x, &y);
-				y += (h = viewer_label(viewer, plane_name[i], x, y));
+				y += (h = viewer_label(viewer, name, x, y));
 				
 				/* controls and more will live here */
 				if (i == INV_PLANE_NUM)
@@ -394,6 +970,40 @@ int main(int argc, char *argv[])
 					int p;
 					int indent = 10;
 					
+					/* this quadrant shows either the controls or the 3D view */
+					{
+						int qw;
+						int qh;
+						
+						viewer_get_quadrant_dim(viewer, &qw, &qh);
+						if (viewer_button(viewer, show_render ? "Controls" : "3D View", x + qw - 80, y - h))
+						{
+							if (!render)
+							{
+								viewer_get_quadrant_dim(viewer, &qw, &qh);
+								render = inv_render_new(inv, opts.isThreaded);
+								rgb = malloc((size_t)qw * qh * 3);
+							}
+							show_render = render && rgb && !show_render;
+							render_dirty = true;
+							viewer_set_render(viewer, show_render);
+						}
+					}
+					if (show_render)
+					{
+						if (viewer_button(viewer, render_mode == INV_RENDER_MIP ? "MIP" : "DVR", x, y))
+						{
+							render_mode = (render_mode + 1) % INV_RENDER_NUM;
+							render_dirty = true;
+						}
+						if (viewer_button(viewer, "Reset", x + 40, y))
+						{
+							render_yaw = render_pitch = 0;
+							render_dirty = true;
+						}
+						continue;
+					}
+					
 					/* patient info */
 					x += indent;
 					{
@@ -511,6 +1121,106 @@ int main(int argc, char *argv[])
 						}
 						y += viewer_label(viewer, "Show Axis Guides", x + 24, y) + pad;
 						
+						/* oblique plane */
+						{
+							const char *result = show_oblique ? "*" : " ";
+							
+							if (viewer_button(viewer, result, x, y))
+							{
+								show_oblique = !show_oblique;
+								oblique_dirty = true;
+								where_last[INV_PLANE_AXIAL] = -1;
+							}
+							if (show_oblique && viewer_button(viewer, "Reset", x + 200, y))
+							{
+								oblique_tilt[0] = oblique_tilt[1] = 0;
+								oblique_dirty = true;
+							}
+						}
+						y += viewer_label(viewer, "Oblique Plane (drag to tilt)", x + 24, y) + pad;
+						
+						/* thick slab */
+						{
+							const char *slab_name[] = { "Single Slice", "MIP", "MinIP", "Average" };
+							int mode_old = slab_mode;
+							int thickness_old = slab_thickness;
+							
+							snprintf(buf, sizeof(buf), "Slab: %s", slab_name[slab_mode + 1]);
+							if (viewer_button(viewer, "<", x + w, y))
+								slab_mode -= 1;
+							if (viewer_button(viewer, ">", x + w + 24, y))
+								slab_mode += 1;
+							
+							/* wrapping */
+							if (slab_mode >= INV_SLAB_NUM)
+								slab_mode = -1;
+							else if (slab_mode < -1)
+								slab_mode = INV_SLAB_NUM - 1;
+							y += viewer_label(viewer, buf, x, y) + pad;
+							
+							/* thickness, in slices */
+							if (slab_mode >= 0)
+							{
+								char num[16];
+								
+								x += indent;
+								viewer_slider_int(viewer, x, y, w / 2, &slab_thickness, 2, 64);
+								snprintf(num, sizeof(num), "%d slices", slab_thickness);
+								viewer_label_inverted(viewer, num, x + 16, y);
+								x -= indent;
+								y += h + pad;
+							}
+							
+							/* on change, queue refresh */
+							if (slab_mode != mode_old || slab_thickness != thickness_old)
+								for (p = 0; p < INV_PLANE_NUM; ++p)
+									where_last[p] = -1;
+						}
+						
+						/* panoramic view along a dental arch, first estimated from the axial slab */
+						{
+							const char *result = show_panoramic ? "*" : " ";
+							bool is_estimated = false;
+							
+							if (viewer_button(viewer, result, x, y))
+							{
+								show_panoramic = !show_panoramic;
+								is_estimated = show_panoramic && arch_num < 2;
+								
+								/* on change, queue refresh */
+								for (p = 0; p < INV_PLANE_NUM; ++p)
+									where_last[p] = -1;
+							}
+							y += viewer_label(viewer, "Panoramic (click axial to draw arch)", x + 24, y) + pad;
+							
+							if (show_panoramic)
+							{
+								char num[16];
+								int thickness_old = panoramic_thickness;
+								
+								x += indent;
+								viewer_slider_int(viewer, x, y, w / 2, &panoramic_thickness, 1, 40);
+								snprintf(num, sizeof(num), "%d voxels", panoramic_thickness);
+								viewer_label_inverted(viewer, num, x + 16, y);
+								if (viewer_button(viewer, "Auto", x + w - indent, y))
+									is_estimated = true;
+								if (viewer_button(viewer, "Clear", x + w - indent + 40, y))
+									arch_num = 0;
+								x -= indent;
+								y += h + pad;
+								
+								if (panoramic_thickness != thickness_old)
+									panoramic_dirty = true;
+							}
+							
+							/* from the teeth in a slab around the axial slice in view */
+							if (is_estimated && !inv_estimate_arch(inv, where[INV_PLANE_AXIAL], slab_thickness, arch, ARCH_ESTIMATED))
+							{
+								arch_num = ARCH_ESTIMATED;
+								panoramic_dirty = true;
+							}
+						}
+						
 						/* threshold */
 						{
 							char buf[16];
@@ -548,8 +1258,53 @@ int main(int argc, char *argv[])
 							
 							/* on change, queue refresh */
 							if (threshold_min != min_old || threshold_max != max_old)
-								for (p = 0; p < INV_PLANE_NUM; ++p)
-									where_last[p] = -1;
+								lut_dirty = true;
+						}
+						
+						/* window, in sample units (8-bit volumes were windowed as they loaded) */
+						if (inv_get_bytes_per_sample(inv) == 2)
+						{
+							char buf[32];
+							int onew = w / 2;
+							int offx = 16;
+							int center_old = window_center;
+							int width_old = window_width;
+							
+							/* header + auto and reset buttons */
+							viewer_label(viewer, "Window", x, y);
+							if (viewer_button(viewer, "Auto", x + 160, y))
+								inv_auto_window(inv, AUTO_WINDOW_LOW, AUTO_WINDOW_HIGH, &window_center, &window_width);
+							if (viewer_button(viewer, "Reset", x + 200, y))
+								window_center = 32768, window_width = 0;
+							y += h + pad;
+							
+							/* indented sliders */
+							x += indent;
+							{
+								viewer_slider_int(viewer, x, y, onew, &window_center, 0, 65535);
+								snprintf(buf, sizeof(buf), "center: %d", window_center);
+								viewer_label_inverted(viewer, buf, x + offx, y);
+								
+								/* second slider is to the right */
+								x += onew + offx;
+								{
+									viewer_slider_int(viewer, x, y, onew, &window_width, 0, 65535);
+									if (window_width > 0)
+										snprintf(buf, sizeof(buf), "width: %d", window_width);
+									else
+										snprintf(buf, sizeof(buf), "width: default");
+									viewer_label_inverted(viewer, buf, x + offx, y);
+								}
+								x -= onew + offx;
+							}
+							x -= indent;
+							
+							/* next row */
+							y += h + pad;
+							
+							/* on change, queue refresh */
+							if (window_center != center_old || window_width != width_old)
+								lut_dirty = true;
 						}
 					}
 					x -= indent;
@@ -559,7 +1314,10 @@ int main(int argc, char *argv[])
 			viewer_show(viewer);
 		}
 		viewer_destroy(viewer);
+		inv_render_free(render);
+		free(rgb);
 		free(pix);
+		free(lut);
 	}
 	
 	/* valgrind test */
@@ -569,14 +1327,13 @@ int main(int argc, char *argv[])
 		int w = inv_get_width(inv);
 		int h = inv_get_height(inv);
 		int big = max3(w, h, num);
-		uint16_t *pix = calloc(big * big, sizeof(*pix));
+		uint16_t *pix = calloc((size_t)big * big, sizeof(*pix));
+		struct plane_copy copy = { pix, inv_get_bytes_per_sample(inv) };
 		
 		for (int frame = 0; frame < big; ++frame)
 			inv_get_plane(inv, pix, frame, INV_PLANE_AXIAL);
-		for (int frame = 0; frame < big; ++frame)
-			inv_get_plane(inv, pix, frame, INV_PLANE_SAGITTAL);
-		for (int frame = 0; frame < big; ++frame)
-			inv_get_plane(inv, pix, frame, INV_PLANE_CORONAL);
+		inv_get_planes(inv, 0, w, INV_PLANE_SAGITTAL, copy_plane, &copy);
+		inv_get_planes(inv, 0, h, INV_PLANE_CORONAL, copy_plane, &copy);
 		
 		inv_make_8bit(pix, big, big, 0, 255);
 		
@@ -585,6 +1342,8 @@ int main(int argc, char *argv[])
 	#endif
 	
 	/* cleanup */
+	inv_mask_free(mask);
 	inv_free(inv);
+	inv_free(whole);
 	return 0;
 }
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "mask.h"
+
+/* each row is padded to whole 64-bit words, so rows never share a word;
+ * padding bits are always zero, which keeps counts exact
+ */
+struct inv_mask
+{
+	int w;
+	int h;
+	int d;
+	int rowWords; // words per row
+	uint64_t *bits; // rowWords * h * d words, x = bit (x & 63) of word (x >> 6)
+};
+
+static inline int PopCount(uint64_t v)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(v);
+#else
+	v = v - ((v >> 1) & 0x5555555555555555ull);
+	v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+	v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return (v * 0x0101010101010101ull) >> 56;
+#endif
+}
+
+static inline size_t MaskWords(const struct inv_mask *mask)
+{
+	return (size_t)mask->rowWords * mask->h * mask->d;
+}
+
+static size_t CountWords(const uint64_t *words, size_t num)
+{
+	size_t count = 0;
+	size_t i;
+	
+	for (i = 0; i < num; ++i)
+		count += PopCount(words[i]);
+	
+	return count;
+}
+
+/* allocates an empty (all zero) mask */
+struct inv_mask *inv_mask_new(int w, int h, int d)
+{
+	struct inv_mask *mask;
+	
+	assert(w > 0);
+	assert(h > 0);
+	assert(d > 0);
+	
+	if (!(mask = calloc(1, sizeof(*mask))))
+	{
+		fprintf(stderr, "memory error\n");
+		return 0;
+	}
+	
+	mask->w = w;
+	mask->h = h;
+	mask->d = d;
+	mask->rowWords = (w + 63) / 64;
+	
+	if (!(mask->bits = calloc(MaskWords(mask), sizeof(*mask->bits))))
+	{
+		fprintf(stderr, "memory error\n");
+		free(mask);
+		return 0;
+	}
+	
+	return mask;
+}
+
+void inv_mask_free(struct inv_mask *mask)
+{
+	if (!mask)
+		return;
+	
+	free(mask->bits);
+	free(mask);
+}
+
+void inv_mask_get_dim(const struct inv_mask *mask, int *w, int *h, int *d)
+{
+	assert(mask);
+	
+	if (w) *w = mask->w;
+	if (h) *h = mask->h;
+	if (d) *d = mask->d;
+}
+
+/* returns the words holding row y of slice z, for filling a mask in bulk;
+ * the bits past the row's width must be left zero
+ */
+uint64_t *inv_mask_get_row(struct inv_mask *mask, int y, int z)
+{
+	assert(mask);
+	assert(y >= 0 && y < mask->h);
+	assert(z >= 0 && z < mask->d);
+	
+	return mask->bits + ((size_t)z * mask->h + y) * mask->rowWords;
+}
+
+bool inv_mask_get(const struct inv_mask *mask, int x, int y, int z)
+{
+	const uint64_t *row;
+	
+	assert(mask);
+	assert(x >= 0 && x < mask->w);
+	
+	row = inv_mask_get_row((struct inv_mask*)mask, y, z);
+	
+	return (row[x >> 6] >> (x & 63)) & 1;
+}
+
+void inv_mask_set(struct inv_mask *mask, int x, int y, int z, bool value)
+{
+	uint64_t *row;
+	uint64_t bit = (uint64_t)1 << (x & 63);
+	
+	assert(mask);
+	assert(x >= 0 && x < mask->w);
+	
+	row = inv_mask_get_row(mask, y, z);
+	
+	if (value)
+		row[x >> 6] |= bit;
+	else
+		row[x >> 6] &= ~bit;
+}
+
+/* number of set samples in the mask */
+size_t inv_mask_count(const struct inv_mask *mask)
+{
+	assert(mask);
+	
+	return CountWords(mask->bits, MaskWords(mask));
+}
+
+/* number of set samples in slice z */
+size_t inv_mask_count_slice(const struct inv_mask *mask, int z)
+{
+	size_t num;
+	
+	assert(mask);
+	assert(z >= 0 && z < mask->d);
+	
+	num = (size_t)mask->rowWords * mask->h;
+	return CountWords(mask->bits + num * z, num);
+}
+
+/* dst &= src; returns non-zero if the dimensions differ */
+int inv_mask_and(struct inv_mask *dst, const struct inv_mask *src)
+{
+	size_t num;
+	size_t i;
+	
+	assert(dst);
+	assert(src);
+	
+	if (dst->w != src->w || dst->h != src->h || dst->d != src->d)
+	{
+		fprintf(stderr, "mask dimensions differ\n");
+		return 1;
+	}
+	
+	num = MaskWords(dst);
+	for (i = 0; i < num; ++i)
+		dst->bits[i] &= src->bits[i];
+	
+	return 0;
+}
+
+/* dst |= src; returns non-zero if the dimensions differ */
+int inv_mask_or(struct inv_mask *dst, const struct inv_mask *src)
+{
+	size_t num;
+	size_t i;
+	
+	assert(dst);
+	assert(src);
+	
+	if (dst->w != src->w || dst->h != src->h || dst->d != src->d)
+	{
+		fprintf(stderr, "mask dimensions differ\n");
+		return 1;
+	}
+	
+	num = MaskWords(dst);
+	for (i = 0; i < num; ++i)
+		dst->bits[i] |= src->bits[i];
+	
+	return 0;
+}
+
+/* inverts every sample (the row padding stays zero) */
+void inv_mask_not(struct inv_mask *mask)
+{
+	uint64_t last;
+	size_t num;
+	size_t i;
+	
+	assert(mask);
+	
+	last = (mask->w & 63) ? ((uint64_t)1 << (mask->w & 63)) - 1 : ~(uint64_t)0;
+	num = MaskWords(mask);
+	for (i = 0; i < num; ++i)
+		mask->bits[i] = ~mask->bits[i];
+	
+	for (i = mask->rowWords - 1; i < num; i += mask->rowWords)
+		mask->bits[i] &= last;
+}
@@ -0,0 +1,23 @@
+#ifndef MASK_H_INCLUDED
+#define MASK_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* a w*h*d volume of 1-bit samples (e.g. a segmentation) */
+struct inv_mask;
+
+struct inv_mask *inv_mask_new(int w, int h, int d);
+void inv_mask_free(struct inv_mask *mask);
+void inv_mask_get_dim(const struct inv_mask *mask, int *w, int *h, int *d);
+uint64_t *inv_mask_get_row(struct inv_mask *mask, int y, int z);
+bool inv_mask_get(const struct inv_mask *mask, int x, int y, int z);
+void inv_mask_set(struct inv_mask *mask, int x, int y, int z, bool value);
+size_t inv_mask_count(const struct inv_mask *mask);
+size_t inv_mask_count_slice(const struct inv_mask *mask, int z);
+int inv_mask_and(struct inv_mask *dst, const struct inv_mask *src);
+int inv_mask_or(struct inv_mask *dst, const struct inv_mask *src);
+void inv_mask_not(struct inv_mask *mask);
+
+#endif /* MASK_H_INCLUDED */
@@ -0,0 +1,775 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <math.h>
+
+#include "render.h"
+#include "inv.h"
+#include "palette.h"
+#include "thread.h"
+
+/* output pixels are rendered in tiles of this many pixels along each edge */
+#define TILE_DIM 16
+
+/* tiles are visited this far apart, so each thread's share of them is
+ * spread across the image instead of being one band of it (prime, so
+ * every tile is visited once unless the tile count is a multiple of it)
+ */
+#define TILE_STRIDE 7919
+
+/* accumulated DVR opacity at which a ray stops */
+#define RAY_OPAQUE 0.98f
+
+struct inv_render
+{
+	struct inv *inv;
+	const uint8_t *strip; // samples, when the volume is a plain strip (else 0)
+	int bps;
+	int w;
+	int h;
+	int d;
+	bool isThreaded;
+	
+	/* transfer function, rebuilt only when the shading changes */
+	uint8_t *shade; // sample -> 8-bit shade, as the viewer's planes show it
+	uint8_t shadeBucket[256]; // highest shade in each run of 256 samples
+	int shadeNum; // 65536 (or 256 for 8-bit volumes)
+	uint8_t color[256][3]; // shade -> color
+	float alpha[256]; // shade -> opacity of one voxel step
+	int thresholdMin; // parameters the tables were built for
+	int thresholdMax;
+	int palette;
+	int windowCenter; // see inv_render_set_window
+	int windowWidth;
+	bool hasTables;
+	
+	/* empty-space skipping over the volume's min/max summary blocks;
+	 * blockMax is the highest shade that any sample interpolated within
+	 * a block can have (0 = nothing visible there)
+	 */
+	uint8_t *blockMax;
+	int blockShift;
+	int blockX;
+	int blockY;
+	int blockZ;
+};
+
+struct renderJob
+{
+	struct inv_render *r;
+	uint8_t *rgb;
+	enum inv_render_mode mode;
+	int w; // output dimensions
+	int h;
+	int tileX; // tiles along each axis
+	int tileY;
+	float dir[3]; // ray direction, in voxels per step
+	float u[3]; // one output pixel to the right
+	float v[3]; // one output pixel down
+	float corner[3]; // ray origin of the first output pixel's top-left corner
+	float len; // length of every ray (the volume's diagonal)
+};
+
+static inline float clampf(float v, float lo, float hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/* trilinear sample at (x, y, z), which must be inside the volume */
+static inline float Sample(const struct inv_render *r, float x, float y, float z)
+{
+	int xi = x;
+	int yi = y;
+	int zi = z;
+	float fx = x - xi;
+	float fy = y - yi;
+	float fz = z - zi;
+	int dx = xi + 1 < r->w;
+	int dy = yi + 1 < r->h;
+	int dz = zi + 1 < r->d;
+	float c[8];
+	
+	if (r->strip)
+	{
+		size_t sy = (size_t)dy * r->w;
+		size_t sz = (size_t)dz * r->w * r->h;
+		size_t i = xi + ((size_t)zi * r->h + yi) * r->w;
+		
+		if (r->bps == 1)
+		{
+			const uint8_t *p = r->strip + i;
+			
+			c[0] = p[0]; c[1] = p[dx]; c[2] = p[sy]; c[3] = p[sy + dx];
+			c[4] = p[sz]; c[5] = p[sz + dx]; c[6] = p[sz + sy]; c[7] = p[sz + sy + dx];
+		}
+		else
+		{
+			const uint16_t *p = ((const uint16_t*)r->strip) + i;
+			
+			c[0] = p[0]; c[1] = p[dx]; c[2] = p[sy]; c[3] = p[sy + dx];
+			c[4] = p[sz]; c[5] = p[sz + dx]; c[6] = p[sz + sy]; c[7] = p[sz + sy + dx];
+		}
+	}
+	else
+	{
+		int k;
+		
+		for (k = 0; k < 8; ++k)
+		{
+			int sx = xi + ((k & 1) ? dx : 0);
+			int sy = yi + ((k & 2) ? dy : 0);
+			int sz = zi + ((k & 4) ? dz : 0);
+			
+			c[k] = r->bps == 1 ? inv_get_sample8(r->inv, sx, sy, sz) : inv_get_sample16(r->inv, sx, sy, sz);
+		}
+	}
+	
+	c[0] += (c[1] - c[0]) * fx;
+	c[2] += (c[3] - c[2]) * fx;
+	c[4] += (c[5] - c[4]) * fx;
+	c[6] += (c[7] - c[6]) * fx;
+	c[0] += (c[2] - c[0]) * fy;
+	c[4] += (c[6] - c[4]) * fy;
+	
+	return c[0] + (c[4] - c[0]) * fz;
+}
+
+/* the ray parameter where a ray at t leaves the summary block at (x, y, z) */
+static inline float BlockExit(const struct inv_render *r, const float *dir, float t, float x, float y, float z)
+{
+	float p[3] = { x, y, z };
+	float exit = INFINITY;
+	int dim = 1 << r->blockShift;
+	int k;
+	
+	for (k = 0; k < 3; ++k)
+	{
+		int b = (int)p[k] >> r->blockShift;
+		float edge;
+		
+		if (dir[k] > 1e-6f)
+			edge = (b + 1) * dim;
+		else if (dir[k] < -1e-6f)
+			edge = b * dim - 1e-3f;
+		else
+			continue;
+		
+		edge = (edge - p[k]) / dir[k];
+		if (edge < exit)
+			exit = edge;
+	}
+	
+	return t + exit;
+}
+
+/* casts the ray through output pixel (px, py), writing its color */
+static void CastRay(const struct renderJob *job, int px, int py, uint8_t *rgb)
+{
+	const struct inv_render *r = job->r;
+	const float *dir = job->dir;
+	float max[3] = { r->w - 1, r->h - 1, r->d - 1 };
+	float o[3];
+	float t0 = 0;
+	float t1 = job->len;
+	float t;
+	float acc[3] = { 0, 0, 0 };
+	float opacity = 0;
+	int best = 0;
+	int k;
+	
+	/* ray origin, then clipped to the volume */
+	for (k = 0; k < 3; ++k)
+	{
+		o[k] = job->corner[k] + job->u[k] * (px + 0.5f) + job->v[k] * (py + 0.5f);
+		
+		if (fabsf(dir[k]) < 1e-6f)
+		{
+			if (o[k] < 0 || o[k] > max[k])
+				t1 = -1;
+		}
+		else
+		{
+			float a = -o[k] / dir[k];
+			float b = (max[k] - o[k]) / dir[k];
+			
+			if (a > b)
+			{
+				float tmp = a;
+				a = b;
+				b = tmp;
+			}
+			if (a > t0) t0 = a;
+			if (b < t1) t1 = b;
+		}
+	}
+	
+	/* samples stay on the lattice t = n, skipped blocks or not */
+	for (t = ceilf(t0); t <= t1; t += 1)
+	{
+		float x = clampf(o[0] + dir[0] * t, 0, max[0]);
+		float y = clampf(o[1] + dir[1] * t, 0, max[1]);
+		float z = clampf(o[2] + dir[2] * t, 0, max[2]);
+		int s;
+		
+		/* skip blocks that can't show anything (or, for MIP, anything brighter) */
+		if (r->blockMax)
+		{
+			int b = (((int)z >> r->blockShift) * r->blockY + ((int)y >> r->blockShift)) * r->blockX + ((int)x >> r->blockShift);
+			int m = r->blockMax[b];
+			
+			if (m == 0 || (job->mode == INV_RENDER_MIP && m <= best))
+			{
+				float next = ceilf(BlockExit(r, dir, t, x, y, z));
+				
+				t = (next > t + 1 ? next : t + 1) - 1;
+				continue;
+			}
+		}
+		
+		s = r->shade[(int)(Sample(r, x, y, z) + 0.5f)];
+		
+		if (job->mode == INV_RENDER_MIP)
+		{
+			if (s > best && (best = s) == 255)
+				break;
+		}
+		else if (r->alpha[s] > 0)
+		{
+			float weight = (1 - opacity) * r->alpha[s];
+			
+			acc[0] += weight * r->color[s][0];
+			acc[1] += weight * r->color[s][1];
+			acc[2] += weight * r->color[s][2];
+			opacity += weight;
+			
+			/* early ray termination */
+			if (opacity >= RAY_OPAQUE)
+				break;
+		}
+	}
+	
+	if (job->mode == INV_RENDER_MIP)
+	{
+		memcpy(rgb, r->color[best], 3);
+		return;
+	}
+	
+	for (k = 0; k < 3; ++k)
+		rgb[k] = acc[k] + 0.5f;
+}
+
+/* renders tiles [begin, end), in TILE_STRIDE order */
+static void RenderTiles(void *udata, int begin, int end)
+{
+	const struct renderJob *job = udata;
+	int num = job->tileX * job->tileY;
+	int stride = num % TILE_STRIDE ? TILE_STRIDE : 1;
+	int i;
+	
+	for (i = begin; i < end; ++i)
+	{
+		int tile = (int)(((long long)i * stride) % num);
+		int x0 = (tile % job->tileX) * TILE_DIM;
+		int y0 = (tile / job->tileX) * TILE_DIM;
+		int x1 = x0 + TILE_DIM < job->w ? x0 + TILE_DIM : job->w;
+		int y1 = y0 + TILE_DIM < job->h ? y0 + TILE_DIM : job->h;
+		int x;
+		int y;
+		
+		for (y = y0; y < y1; ++y)
+			for (x = x0; x < x1; ++x)
+				CastRay(job, x, y, job->rgb + ((size_t)y * job->w + x) * 3);
+	}
+}
+
+struct inv_render *inv_render_new(struct inv *inv, bool isThreaded)
+{
+	struct inv_render *r;
+	int dim;
+	
+	assert(inv);
+	
+	if (!(r = calloc(1, sizeof(*r))))
+		return 0;
+	
+	r->inv = inv;
+	r->isThreaded = isThreaded;
+	r->bps = inv_get_bytes_per_sample(inv);
+	r->strip = inv_get_gray(inv, &r->w, &r->h, &r->d);
+	r->shadeNum = r->bps == 1 ? 256 : 65536;
+	
+	/* the summary is optional; without it, nothing is skipped */
+	inv_get_range_grid(inv, &dim, &r->blockX, &r->blockY, &r->blockZ);
+	for (r->blockShift = 0; (1 << r->blockShift) < dim; ++r->blockShift)
+		;
+	
+	if (!(r->shade = malloc(r->shadeNum))
+		|| (r->blockX && !(r->blockMax = malloc((size_t)r->blockX * r->blockY * r->blockZ)))
+	)
+	{
+		fprintf(stderr, "memory error\n");
+		inv_render_free(r);
+		return 0;
+	}
+	
+	return r;
+}
+
+void inv_render_free(struct inv_render *r)
+{
+	if (!r)
+		return;
+	
+	free(r->shade);
+	free(r->blockMax);
+	free(r);
+}
+
+/* highest shade of any sample in [lo, hi] */
+static int ShadeRangeMax(const struct inv_render *r, int lo, int hi)
+{
+	int m = 0;
+	int v = lo;
+	
+	while (v <= hi)
+	{
+		if (!(v & 255) && v + 255 <= hi)
+		{
+			if (r->shadeBucket[v >> 8] > m)
+				m = r->shadeBucket[v >> 8];
+			v += 256;
+		}
+		else
+		{
+			if (r->shade[v] > m)
+				m = r->shade[v];
+			v += 1;
+		}
+	}
+	
+	return m;
+}
+
+/* sets the transfer function: the viewer's 8-bit shading and thresholds
+ * (see inv_make_8bit and inv_render_set_window), colored by a palette
+ * (-1 for grayscale); brighter shades are more opaque; returns non-zero
+ * on memory errors
+ */
+int inv_render_set_shading(struct inv_render *r, int threshold_min, int threshold_max, int palette)
+{
+	int bx;
+	int by;
+	int bz;
+	int i;
+	
+	assert(r);
+	
+	if (r->hasTables
+		&& r->thresholdMin == threshold_min
+		&& r->thresholdMax == threshold_max
+		&& r->palette == palette
+	)
+		return 0;
+	
+	/* shade every possible sample as a viewer plane would */
+	if (r->bps == 1)
+	{
+		for (i = 0; i < 256; ++i)
+			r->shade[i] = i;
+		inv_threshold_8bit(r->shade, 256, 1, threshold_min, threshold_max);
+	}
+	else
+		inv_make_lut(r->shade, r->windowCenter, r->windowWidth, threshold_min, threshold_max);
+	memset(r->shadeBucket, 0, sizeof(r->shadeBucket));
+	for (i = 0; i < r->shadeNum; ++i)
+		if (r->shade[i] > r->shadeBucket[i >> 8])
+			r->shadeBucket[i >> 8] = r->shade[i];
+	
+	for (i = 0; i < 256; ++i)
+	{
+		float f = i / 255.0f;
+		
+		if (palette >= 0)
+			palette_color(r->color[i], palette, i);
+		else
+			r->color[i][0] = r->color[i][1] = r->color[i][2] = i;
+		r->alpha[i] = f * f * f * 0.5f;
+	}
+	r->alpha[0] = 0;
+	
+	/* a sample interpolated within a block also reads the next block along
+	 * each axis, so each block's shade range covers those too
+	 */
+	for (bz = 0; bz < r->blockZ; ++bz)
+	{
+		for (by = 0; by < r->blockY; ++by)
+		{
+			for (bx = 0; bx < r->blockX; ++bx)
+			{
+				int lo = INT32_MAX;
+				int hi = 0;
+				int k;
+				
+				for (k = 0; k < 8; ++k)
+				{
+					int nx = bx + (k & 1);
+					int ny = by + ((k >> 1) & 1);
+					int nz = bz + (k >> 2);
+					int min;
+					int max;
+					
+					if (nx >= r->blockX || ny >= r->blockY || nz >= r->blockZ)
+						continue;
+					
+					inv_get_range(r->inv, nx, ny, nz, &min, &max);
+					if (min < lo) lo = min;
+					if (max > hi) hi = max;
+				}
+				
+				r->blockMax[((size_t)bz * r->blockY + by) * r->blockX + bx] = ShadeRangeMax(r, lo, hi);
+			}
+		}
+	}
+	
+	r->thresholdMin = threshold_min;
+	r->thresholdMax = threshold_max;
+	r->palette = palette;
+	r->hasTables = true;
+	
+	return 0;
+}
+
+/* shades 16-bit volumes through a window (see inv_make_lut; width <= 0
+ * is the default mapping) from the next inv_render_set_shading on;
+ * 8-bit volumes were windowed as they loaded, so they ignore this
+ */
+void inv_render_set_window(struct inv_render *r, int window_center, int window_width)
+{
+	assert(r);
+	
+	if (r->windowCenter == window_center && r->windowWidth == window_width)
+		return;
+	
+	r->windowCenter = window_center;
+	r->windowWidth = window_width;
+	r->hasTables = r->hasTables && r->bps == 1;
+}
+
+/* renders the volume into w*h RGB pixels (3 bytes each) with a parallel
+ * projection; the view starts out looking front to back with the top of
+ * the skull up, then pitches about the image's horizontal axis and turns
+ * about the skull's vertical axis (both in radians); call
+ * inv_render_set_shading first
+ */
+void inv_render_draw(struct inv_render *r, uint8_t *rgb, int w, int h, float yaw, float pitch, enum inv_render_mode mode)
+{
+	struct renderJob job = {0};
+	float cy = cosf(yaw);
+	float sy = sinf(yaw);
+	float cp = cosf(pitch);
+	float sp = sinf(pitch);
+	float center[3] = { (r->w - 1) * 0.5f, (r->h - 1) * 0.5f, (r->d - 1) * 0.5f };
+	float scale;
+	int k;
+	
+	assert(r);
+	assert(rgb);
+	assert(r->hasTables);
+	assert(w > 0 && h > 0);
+	assert(mode >= 0 && mode < INV_RENDER_NUM);
+	
+	job.r = r;
+	job.rgb = rgb;
+	job.mode = mode;
+	job.w = w;
+	job.h = h;
+	job.tileX = (w + TILE_DIM - 1) / TILE_DIM;
+	job.tileY = (h + TILE_DIM - 1) / TILE_DIM;
+	job.len = sqrtf((float)r->w * r->w + (float)r->h * r->h + (float)r->d * r->d);
+	
+	/* camera basis: along +y, right = +x, down = -z; then rotated */
+	job.dir[0] = -cp * sy; job.dir[1] = cp * cy; job.dir[2] = sp;
+	job.u[0] = cy; job.u[1] = sy; job.u[2] = 0;
+	job.v[0] = -sp * sy; job.v[1] = sp * cy; job.v[2] = -cp;
+	
+	/* the volume's diagonal spans the smaller output dimension */
+	scale = job.len / (w < h ? w : h);
+	for (k = 0; k < 3; ++k)
+	{
+		job.u[k] *= scale;
+		job.v[k] *= scale;
+		job.corner[k] = center[k] - job.u[k] * w * 0.5f - job.v[k] * h * 0.5f - job.dir[k] * job.len * 0.5f;
+	}
+	
+	thread_for(r->isThreaded && inv_is_thread_safe(r->inv), job.tileX * job.tileY, RenderTiles, &job);
+}
+
+struct drrJob
+{
+	const struct inv_render *r;
+	float *sum; // line integral of every output pixel
+	int w;
+	float source[3];
+	float corner[3]; // top-left corner of the first pixel, on the plane through the volume's center
+	float u[3]; // one pixel to the right, on that plane
+	float v[3]; // one pixel down
+};
+
+/* the shade of voxel (x, y, z), which is sample i of a strip */
+static inline int VoxelShade(const struct inv_render *r, size_t i, const int *ix)
+{
+	if (r->strip)
+		return r->shade[r->bps == 1 ? r->strip[i] : ((const uint16_t*)r->strip)[i]];
+	
+	return r->shade[r->bps == 1
+		? inv_get_sample8(r->inv, ix[0], ix[1], ix[2])
+		: inv_get_sample16(r->inv, ix[0], ix[1], ix[2])
+	];
+}
+
+/* when a ray crosses the plane 'boundary' (an integer) along one axis;
+ * skipping and stepping both go through this, so they agree exactly
+ */
+static inline float Crossing(float o, float inv, int boundary)
+{
+	return ((float)boundary - o) * inv;
+}
+
+/* the voxel along one axis that a ray is in just past t */
+static inline int RayVoxel(float o, float dir, float inv, int dim, float t)
+{
+	int c = floorf(o + dir * t);
+	
+	if (dir > 0)
+	{
+		while (Crossing(o, inv, c + 1) <= t)
+			++c;
+		while (Crossing(o, inv, c) > t)
+			--c;
+	}
+	else if (dir < 0)
+	{
+		while (Crossing(o, inv, c) <= t)
+			--c;
+		while (Crossing(o, inv, c + 1) > t)
+			++c;
+	}
+	
+	return c < 0 ? 0 : (c >= dim ? dim - 1 : c);
+}
+
+/* the sum of the shades along the ray from o in direction dir (a unit
+ * vector), by Siddon's method done incrementally (as Jacobs et al. and
+ * Amanatides & Woo do): each voxel the ray crosses is weighted by the
+ * length of the ray within it; voxel i spans [i, i + 1) on each axis,
+ * and summary blocks with nothing visible are jumped over
+ */
+static float TraceRay(const struct drrJob *job, const float *o, const float *dir)
+{
+	const struct inv_render *r = job->r;
+	int dim[3] = { r->w, r->h, r->d };
+	size_t stride[3] = { 1, r->w, (size_t)r->w * r->h };
+	float inv[3];
+	float tNext[3]; // when the ray leaves the current voxel along each axis
+	int up[3]; // 1 if the ray heads toward higher indices along an axis
+	int ix[3];
+	int block = -1;
+	float t0 = 0;
+	float t1 = INFINITY;
+	float sum = 0;
+	float t;
+	int k;
+	
+	/* clip to the volume */
+	for (k = 0; k < 3; ++k)
+	{
+		up[k] = dir[k] > 0;
+		if (dir[k] == 0)
+		{
+			inv[k] = INFINITY;
+			if (o[k] < 0 || o[k] >= dim[k])
+				return 0;
+		}
+		else
+		{
+			float a;
+			float b;
+			
+			inv[k] = 1 / dir[k];
+			a = Crossing(o[k], inv[k], up[k] ? 0 : dim[k]);
+			b = Crossing(o[k], inv[k], up[k] ? dim[k] : 0);
+			if (a > t0) t0 = a;
+			if (b < t1) t1 = b;
+		}
+	}
+	
+	for (t = t0; t < t1; )
+	{
+		size_t i = 0;
+		
+		/* (re)start in the voxel just past t */
+		for (k = 0; k < 3; ++k)
+		{
+			ix[k] = dir[k] == 0 ? (int)o[k] : RayVoxel(o[k], dir[k], inv[k], dim[k], t);
+			tNext[k] = dir[k] == 0 ? INFINITY : Crossing(o[k], inv[k], ix[k] + up[k]);
+			i += ix[k] * stride[k];
+		}
+		
+		/* voxel to voxel, until the ray leaves the volume or enters an empty block */
+		for (;;)
+		{
+			int a = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+			float tn = tNext[a] < t1 ? tNext[a] : t1;
+			
+			if (r->blockMax)
+			{
+				int s = r->blockShift;
+				int b = ((ix[2] >> s) * r->blockY + (ix[1] >> s)) * r->blockX + (ix[0] >> s);
+				
+				if (b != block && !r->blockMax[(block = b)])
+				{
+					float exit = t1;
+					
+					for (k = 0; k < 3; ++k)
+					{
+						if (dir[k] != 0)
+						{
+							float te = Crossing(o[k], inv[k], ((ix[k] >> s) + up[k]) << s);
+							
+							if (te < exit)
+								exit = te;
+						}
+					}
+					t = exit;
+					break;
+				}
+			}
+			
+			sum += VoxelShade(r, i, ix) * (tn - t);
+			t = tn;
+			if (t >= t1)
+				break;
+			
+			ix[a] += up[a] ? 1 : -1;
+			if (ix[a] < 0 || ix[a] >= dim[a])
+			{
+				t = t1;
+				break;
+			}
+			i = up[a] ? i + stride[a] : i - stride[a];
+			tNext[a] = Crossing(o[a], inv[a], ix[a] + up[a]);
+		}
+	}
+	
+	return sum;
+}
+
+/* traces the rays of output rows [begin, end) */
+static void DrrRows(void *udata, int begin, int end)
+{
+	const struct drrJob *job = udata;
+	int y;
+	
+	for (y = begin; y < end; ++y)
+	{
+		int x;
+		
+		for (x = 0; x < job->w; ++x)
+		{
+			float dir[3];
+			float len;
+			int k;
+			
+			for (k = 0; k < 3; ++k)
+				dir[k] = job->corner[k] + job->u[k] * (x + 0.5f) + job->v[k] * (y + 0.5f) - job->source[k];
+			len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+			for (k = 0; k < 3; ++k)
+				dir[k] /= len;
+			
+			job->sum[(size_t)y * job->w + x] = TraceRay(job, job->source, dir);
+		}
+	}
+}
+
+/* renders a digitally reconstructed radiograph (e.g. a cephalogram) into
+ * w*h 8-bit pixels, as if from a point source 'distance' voxels from the
+ * volume's center, with the volume's center at unit magnification; each
+ * pixel is the sum of the shades (see inv_render_set_shading) along its
+ * ray, scaled so that the largest sum is white; lateral views look from
+ * the skull's right with the face to the right, and PA (posteroanterior)
+ * views look from behind with the skull's right to the left; returns
+ * non-zero on memory errors
+ */
+int inv_render_drr(struct inv_render *r, uint8_t *gray, int w, int h, enum inv_drr_view view, float distance)
+{
+	struct drrJob job = {0};
+	float center[3] = { r->w * 0.5f, r->h * 0.5f, r->d * 0.5f };
+	float axis[3] = { 0, 0, 0 }; // from the source to the detector
+	float extent;
+	float depth;
+	float scale;
+	float max = 0;
+	size_t n = (size_t)w * h;
+	size_t i;
+	int k;
+	
+	assert(r);
+	assert(gray);
+	assert(r->hasTables);
+	assert(w > 0 && h > 0);
+	assert(view >= 0 && view < INV_DRR_NUM);
+	
+	if (!(job.sum = malloc(n * sizeof(*job.sum))))
+	{
+		fprintf(stderr, "memory error\n");
+		return 1;
+	}
+	
+	/* image rows always run down the skull */
+	job.v[2] = -1;
+	if (view == INV_DRR_LATERAL)
+	{
+		axis[0] = 1;
+		job.u[1] = -1;
+		extent = r->h > r->d ? r->h : r->d;
+		depth = r->w;
+	}
+	else
+	{
+		axis[1] = -1;
+		job.u[0] = 1;
+		extent = r->w > r->d ? r->w : r->d;
+		depth = r->h;
+	}
+	
+	/* the near side of the volume is magnified most; it fits the smaller output dimension */
+	if (distance < depth)
+		distance = depth;
+	scale = extent * distance / (distance - depth * 0.5f) / (w < h ? w : h);
+	
+	job.r = r;
+	job.w = w;
+	for (k = 0; k < 3; ++k)
+	{
+		job.u[k] *= scale;
+		job.v[k] *= scale;
+		job.source[k] = center[k] - axis[k] * distance;
+		job.corner[k] = center[k] - job.u[k] * w * 0.5f - job.v[k] * h * 0.5f;
+	}
+	
+	thread_for(r->isThreaded && inv_is_thread_safe(r->inv), h, DrrRows, &job);
+	
+	for (i = 0; i < n; ++i)
+		if (job.sum[i] > max)
+			max = job.sum[i];
+	scale = max > 0 ? 255 / max : 0;
+	for (i = 0; i < n; ++i)
+		gray[i] = job.sum[i] * scale + 0.5f;
+	
+	free(job.sum);
+	
+	return 0;
+}
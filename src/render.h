@@ -0,0 +1,33 @@
+#ifndef RENDER_H_INCLUDED
+#define RENDER_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct inv;
+
+/* a CPU volume renderer for one volume (e.g. the viewer's 3D quadrant) */
+struct inv_render;
+
+enum inv_render_mode
+{
+	INV_RENDER_MIP = 0 // maximum intensity projection
+	, INV_RENDER_DVR   // direct volume rendering (emission/absorption)
+	, INV_RENDER_NUM   // num modes in this enum
+};
+
+enum inv_drr_view
+{ // digitally reconstructed radiographs (see inv_render_drr)
+	INV_DRR_LATERAL = 0 // from the right, face to the right
+	, INV_DRR_PA        // posteroanterior: from behind, right to the left
+	, INV_DRR_NUM       // num views in this enum
+};
+
+struct inv_render *inv_render_new(struct inv *inv, bool isThreaded);
+void inv_render_free(struct inv_render *r);
+int inv_render_set_shading(struct inv_render *r, int threshold_min, int threshold_max, int palette);
+void inv_render_set_window(struct inv_render *r, int window_center, int window_width);
+void inv_render_draw(struct inv_render *r, uint8_t *rgb, int w, int h, float yaw, float pitch, enum inv_render_mode mode);
+int inv_render_drr(struct inv_render *r, uint8_t *gray, int w, int h, enum inv_drr_view view, float distance);
+
+#endif /* RENDER_H_INCLUDED */
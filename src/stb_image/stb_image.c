@@ -4,7 +4,6 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#ifdef WRITE_FRAMES /* XXX this was added only for creating animated GIFs */
+/* for --drr (and the viewer's WRITE_FRAMES) */
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
-#endif
@@ -0,0 +1,123 @@
+#ifdef WANT_THREADS
+#define JAS_FOR_JASPER_APP_USE_ONLY /* XXX expose libjasper's threading */
+#endif
+
+#ifndef _WIN32
+#	define _POSIX_C_SOURCE 200112L /* sysconf */
+#	include <unistd.h>
+#else
+#	include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <jasper/jasper.h>
+
+#include "thread.h"
+
+/* fallback if no threading is available */
+#if defined(WANT_THREADS) && !defined(JAS_THREADS)
+#	undef WANT_THREADS
+#endif
+
+/* number of threads thread_for() splits work across */
+int thread_count(void)
+{
+	static int count = 0;
+	
+	if (count)
+		return count;
+	
+#if defined(_WIN32)
+	{
+		SYSTEM_INFO info;
+		
+		GetSystemInfo(&info);
+		count = info.dwNumberOfProcessors;
+	}
+#elif defined(_SC_NPROCESSORS_ONLN)
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	
+	if (count < 1)
+		count = 1;
+	if (count > THREAD_MAX)
+		count = THREAD_MAX;
+	
+	return count;
+}
+
+#ifdef WANT_THREADS
+struct threadJob
+{
+	jas_thread_t thread;
+	thread_func *func;
+	void *udata;
+	int begin;
+	int end;
+};
+
+static int threadJob(void *handle)
+{
+	struct threadJob *job = handle;
+	
+	job->func(job->udata, job->begin, job->end);
+	
+	return 0;
+}
+#endif /* WANT_THREADS */
+
+/* runs func over items [0, num), split into contiguous ranges across
+ * threads when threading is enabled and available (serially otherwise)
+ */
+void thread_for(bool isThreaded, int num, thread_func *func, void *udata)
+{
+#ifdef WANT_THREADS
+	struct threadJob job[THREAD_MAX];
+	int jobNum = thread_count();
+	int started = 0;
+	int i;
+	
+	if (num <= 0)
+		return;
+	
+	if (!isThreaded || jobNum < 2 || num < 2)
+	{
+		func(udata, 0, num);
+		return;
+	}
+	
+	if (jobNum > num)
+		jobNum = num;
+	
+	/* the calling thread takes the first range itself */
+	for (i = 1; i < jobNum; ++i)
+	{
+		struct threadJob *this = &job[i];
+		
+		this->func = func;
+		this->udata = udata;
+		this->begin = (long long)num * i / jobNum;
+		this->end = (long long)num * (i + 1) / jobNum;
+		
+		if (jas_thread_create(&this->thread, threadJob, this))
+		{
+			/* couldn't spawn; do the remaining work here instead */
+			func(udata, this->begin, num);
+			break;
+		}
+		started = i;
+	}
+	func(udata, 0, num / jobNum);
+	
+	/* wait on threads to finish */
+	for (i = 1; i <= started; ++i)
+		jas_thread_join(&job[i].thread, 0);
+#else
+	(void)isThreaded;
+	
+	if (num > 0)
+		func(udata, 0, num);
+#endif
+}
@@ -0,0 +1,15 @@
+#ifndef THREAD_H_INCLUDED
+#define THREAD_H_INCLUDED
+
+#include <stdbool.h>
+
+/* most threads thread_for() will use */
+#define THREAD_MAX 64
+
+/* work function, processes items in range [begin, end) */
+typedef void thread_func(void *udata, int begin, int end);
+
+int thread_count(void);
+void thread_for(bool isThreaded, int num, thread_func *func, void *udata);
+
+#endif /* THREAD_H_INCLUDED */
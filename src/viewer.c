@@ -7,7 +7,7 @@
 #include "palette.h"
 
 #define WINDOW_NAME "Invivo CBCT Viewer"
-#define BUF_NUM  3
+#define BUF_NUM  4
 #define TEXT_PAD 4
 
 #define COMMON_CONTROL_H 15
@@ -20,6 +20,8 @@ struct viewer_mouse
 	int x;
 	int y;
 	int wheel;
+	int dx; // motion since the last viewer_events
+	int dy;
 	bool is_held;
 	bool was_pressed;
 };
@@ -43,6 +45,10 @@ struct viewer
 	} contrast;
 	bool is_inverted;
 	bool show_axis_guides;
+	bool show_render; // fourth quadrant shows buf[3] (see viewer_upload_rgb)
+	const float *curve; // x,y pairs drawn over the axial quadrant (see viewer_set_curve)
+	int curve_num;
+	SDL_Rect drawn[BUF_NUM]; // where each quadrant's image was last drawn
 	struct
 	{
 		SDL_Cursor *horz;
@@ -152,10 +158,11 @@ struct viewer *viewer_create(int x, int y, int z, int window_w, int window_h)
 {
 	struct viewer *v;
 	int i;
-	int dim[3][2] = { // XXX same order as enum inv_plane
+	int dim[BUF_NUM][2] = { // XXX same order as enum inv_plane
 		{x, y} // axial
 		, {y, z} // sagittal
 		, {x, z} // coronal
+		, {x, y} // rendering, resized on upload
 	};
 	
 	v = calloc(1, sizeof(*v));
@@ -222,6 +229,14 @@ void viewer_get_dim(struct viewer *v, int i, int *w, int *h)
 	SDL_QueryTexture(v->buf[i], 0, 0, w, h);
 }
 
+void viewer_get_quadrant_dim(struct viewer *v, int *w, int *h)
+{
+	assert(v);
+	
+	*w = v->vp_w;
+	*h = v->vp_h;
+}
+
 int viewer_events(struct viewer *v)
 {
 	SDL_Event event;
@@ -229,6 +244,8 @@ int viewer_events(struct viewer *v)
 	
 	v->mouse.was_pressed = false;
 	v->mouse.wheel = 0;
+	v->mouse.dx = 0;
+	v->mouse.dy = 0;
 	
 	while (SDL_PollEvent(&event))
 	{
@@ -258,6 +275,8 @@ int viewer_events(struct viewer *v)
 			case SDL_MOUSEMOTION:
 				v->mouse.x = event.motion.x;
 				v->mouse.y = event.motion.y;
+				v->mouse.dx += event.motion.xrel;
+				v->mouse.dy += event.motion.yrel;
 				break;
 			
 			case SDL_MOUSEBUTTONDOWN:
@@ -327,9 +346,25 @@ void viewer_upload_pixels(struct viewer *v, const void *src, int srcW, int srcH,
 	void *dst;
 	int pitch;
 	int i;
+	int w;
+	int h;
 	
 	SDL_Texture *tex = v->buf[idx];
 	
+	/* resize texture to fit (e.g. when showing a downscaled plane) */
+	SDL_QueryTexture(tex, 0, 0, &w, &h);
+	if (w != srcW || h != srcH)
+	{
+		SDL_DestroyTexture(tex);
+		tex = v->buf[idx] = SDL_CreateTexture(
+			v->renderer
+			, SDL_PIXELFORMAT_RGBA8888
+			, SDL_TEXTUREACCESS_STREAMING
+			, srcW
+			, srcH
+		);
+	}
+	
 	SDL_LockTexture(tex, 0, &dst, &pitch);
 	
 	dst8 = dst;
@@ -403,6 +438,50 @@ void viewer_upload_pixels(struct viewer *v, const void *src, int srcW, int srcH,
 	SDL_UnlockTexture(tex);
 }
 
+/* like viewer_upload_pixels, but for pixels that are already colored
+ * (3 bytes each), so only inversion applies
+ */
+void viewer_upload_rgb(struct viewer *v, const uint8_t *src, int srcW, int srcH, int idx)
+{
+	uint8_t *dst8;
+	void *dst;
+	int pitch;
+	int i;
+	int w;
+	int h;
+	
+	SDL_Texture *tex = v->buf[idx];
+	
+	/* resize texture to fit */
+	SDL_QueryTexture(tex, 0, 0, &w, &h);
+	if (w != srcW || h != srcH)
+	{
+		SDL_DestroyTexture(tex);
+		tex = v->buf[idx] = SDL_CreateTexture(
+			v->renderer
+			, SDL_PIXELFORMAT_RGBA8888
+			, SDL_TEXTUREACCESS_STREAMING
+			, srcW
+			, srcH
+		);
+	}
+	
+	SDL_LockTexture(tex, 0, &dst, &pitch);
+	
+	dst8 = dst;
+	for (i = 0; i < srcW * srcH; ++i, src += 3, dst8 += 4)
+	{
+		int z = v->is_inverted ? 255 : 0;
+		
+		dst8[0] = 0xff; // opacity
+		dst8[1] = src[2] ^ z;
+		dst8[2] = src[1] ^ z;
+		dst8[3] = src[0] ^ z;
+	}
+	
+	SDL_UnlockTexture(tex);
+}
+
 static float get_aspect(float w, float h)
 {
 	return w / h;
@@ -454,6 +533,8 @@ int viewer_draw_quadrants(struct viewer *v)
 	draw_quadrant(v, 0);
 	draw_quadrant(v, 1);
 	draw_quadrant(v, 2);
+	if (v->show_render)
+		draw_quadrant(v, 3);
 	
 	return 0;
 }
@@ -605,6 +686,22 @@ void viewer_set_inverted(struct viewer *v, bool is_inverted)
 	v->is_inverted = is_inverted;
 }
 
+void viewer_set_render(struct viewer *v, bool enabled)
+{
+	assert(v);
+	
+	v->show_render = enabled;
+}
+
+/* points (x,y pairs, as fractions of the image) joined by lines over the axial quadrant */
+void viewer_set_curve(struct viewer *v, const float *xy, int num)
+{
+	assert(v);
+	
+	v->curve = xy;
+	v->curve_num = num;
+}
+
 void viewer_set_axes(struct viewer *v, bool enabled, float *axis)
 {
 	assert(v);
@@ -636,9 +733,30 @@ static void draw_quadrant(struct viewer *v, int quadrant)
 	/* draw subwindow */
 	viewer_get_quadrant(v, quadrant % 2, quadrant / 2, &x, &y);
 	rect = draw_aspect(ren, v->buf[quadrant], (SDL_Rect){x, y, v->vp_w, v->vp_h});
+	v->drawn[quadrant] = rect;
+	
+	/* draw curve */
+	if (quadrant == 0 && v->curve_num > 0)
+	{
+		SDL_SetRenderDrawColor(ren, 0xff, 0xff, 0, 0xff);
+		for (i = 0; i < v->curve_num; ++i)
+		{
+			int px = rect.x + rect.w * v->curve[i * 2];
+			int py = rect.y + rect.h * v->curve[i * 2 + 1];
+			
+			SDL_RenderFillRect(ren, &(SDL_Rect){px - 2, py - 2, 5, 5});
+			if (i > 0)
+				SDL_RenderDrawLine(ren
+					, rect.x + rect.w * v->curve[i * 2 - 2]
+					, rect.y + rect.h * v->curve[i * 2 - 1]
+					, px
+					, py
+				);
+		}
+	}
 	
-	/* draw axes */
-	for (i = 0; v->show_axis_guides && i < 3; ++i)
+	/* draw axes (the rendering has none) */
+	for (i = 0; v->show_axis_guides && quadrant < 3 && i < 3; ++i)
 	{
 		SDL_Rect tmp;
 		SDL_Color col = color[i];
@@ -733,3 +851,51 @@ int viewer_get_mouse_wheel_in_quadrant(struct viewer *v, int quadrant)
 	
 	return 0;
 }
+
+/* where a click (press and release) landed on a quadrant's image this
+ * frame, as fractions of the image (returns false if there was none)
+ */
+bool viewer_get_mouse_click_in_quadrant(struct viewer *v, int quadrant, float *x, float *y)
+{
+	SDL_Rect rect;
+	
+	assert(v);
+	
+	rect = v->drawn[quadrant];
+	if (!was_mouse_pressed(v)
+		|| v->grab_axis.active
+		|| rect.w <= 0
+		|| rect.h <= 0
+		|| !is_mouse_in_rect(v, rect.x, rect.y, rect.w - 1, rect.h - 1)
+	)
+		return false;
+	
+	*x = (float)(v->mouse.x - rect.x) / rect.w;
+	*y = (float)(v->mouse.y - rect.y) / rect.h;
+	
+	return true;
+}
+
+/* mouse motion this frame while dragging inside a quadrant
+ * (returns false when not dragging there, or dragging an axis guide)
+ */
+bool viewer_get_mouse_drag_in_quadrant(struct viewer *v, int quadrant, int *dx, int *dy)
+{
+	int x;
+	int y;
+	
+	assert(v);
+	
+	viewer_get_quadrant(v, quadrant % 2, quadrant / 2, &x, &y);
+	
+	if (!is_mouse_held(v)
+		|| v->grab_axis.active
+		|| !is_mouse_in_rect(v, x, y, v->vp_w, v->vp_h)
+	)
+		return false;
+	
+	*dx = v->mouse.dx;
+	*dy = v->mouse.dy;
+	
+	return true;
+}
@@ -2,16 +2,19 @@
 #define VIEWER_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct viewer;
 
 void viewer_upload_pixels(struct viewer *v, const void *src, int srcW, int srcH, int idx);
+void viewer_upload_rgb(struct viewer *v, const uint8_t *src, int srcW, int srcH, int idx);
 struct viewer *viewer_create(int x, int y, int z, int window_w, int window_h);
 int viewer_destroy(struct viewer *v);
 int viewer_events(struct viewer *v);
 int viewer_draw_quadrants(struct viewer *v);
 void viewer_show(struct viewer *v);
 void viewer_get_dim(struct viewer *v, int i, int *w, int *h);
+void viewer_get_quadrant_dim(struct viewer *v, int *w, int *h);
 void viewer_clear(struct viewer *v);
 int viewer_label(struct viewer *v, const char *str, int x, int y);
 int viewer_label_inverted(struct viewer *v, const char *str, int x, int y);
@@ -20,7 +23,11 @@ int viewer_slider_int(struct viewer *v, int x, int y, int w, int *n, int lo, int
 bool viewer_button(struct viewer *v, const char *str, int x, int y);
 void viewer_set_palette(struct viewer *v, int palette);
 void viewer_set_inverted(struct viewer *v, bool is_inverted);
+void viewer_set_render(struct viewer *v, bool enabled);
+void viewer_set_curve(struct viewer *v, const float *xy, int num);
 void viewer_set_axes(struct viewer *v, bool enabled, float *axis);
 int viewer_get_mouse_wheel_in_quadrant(struct viewer *v, int quadrant);
+bool viewer_get_mouse_drag_in_quadrant(struct viewer *v, int quadrant, int *dx, int *dy);
+bool viewer_get_mouse_click_in_quadrant(struct viewer *v, int quadrant, float *x, float *y);
 
 #endif /* VIEWER_H_INCLUDED */